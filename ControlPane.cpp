@@ -45,6 +45,7 @@ LRESULT CControlPane::HandleInitDialog( WPARAM wParam, LPARAM lParam )
 	m_SelectExample.AddString( _T( "Example3" ) );
 	m_SelectExample.AddString( _T( "Example4" ) );
 	m_SelectExample.AddString( _T( "Example5" ) );
+	m_SelectExample.AddString( _T( "Example6" ) );
 	m_SelectExample.SetCurSel( 0 );
 
 	return TRUE;
@@ -105,6 +106,9 @@ void CControlPane::OnExampleChanged()
 		case 4:
 			theApp.m_pExample = std::make_unique<Example5>();
 			break;
+		case 5:
+			theApp.m_pExample = std::make_unique<Example6>();
+			break;
 	}
 
 	((CMainFrame*)theApp.GetMainWnd())->GetChildView().Invalidate( FALSE );
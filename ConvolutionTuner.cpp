@@ -0,0 +1,184 @@
+#include "pch.h"
+#include "ConvolutionTuner.h"
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <omp.h>
+
+namespace ToyDNN
+{
+	ConvolutionTuner::ConvolutionTuner( const char* _cacheFilename ) :
+		m_Filename( _cacheFilename ),
+		m_CpuName( GetCpuName() )
+	{
+		Load();
+	}
+
+	void ConvolutionTuner::Load()
+	{
+		std::ifstream fileStream( m_Filename );
+
+		//One plan per line: CPU name, layer shape, algorithm and thread count separated by tabs
+		std::string line;
+
+		while( std::getline( fileStream, line ) )
+		{
+			size_t shapeBegin = line.find( '\t' );
+			size_t algorithmBegin = (shapeBegin != std::string::npos) ? line.find( '\t', shapeBegin + 1 ) : std::string::npos;
+			size_t threadsBegin = (algorithmBegin != std::string::npos) ? line.find( '\t', algorithmBegin + 1 ) : std::string::npos;
+
+			if( threadsBegin == std::string::npos )
+				continue;
+
+			Plan plan;
+
+			if( !FindAlgorithm( line.substr( algorithmBegin + 1, threadsBegin - algorithmBegin - 1 ), plan.Algorithm ) )
+				continue; //Written by another version
+
+			plan.NumThreads = atoi( line.c_str() + threadsBegin + 1 );
+			m_Plans[line.substr( 0, algorithmBegin )] = plan;
+		}
+	}
+
+	bool ConvolutionTuner::Save()
+	{
+		if( !m_IsModified )
+			return true;
+
+		std::ofstream fileStream( m_Filename );
+
+		if( !fileStream.good() )
+			return false;
+
+		for( const auto& entry : m_Plans )
+			fileStream << entry.first << '\t' << GetAlgorithmName( entry.second.Algorithm ) << '\t' << entry.second.NumThreads << '\n';
+
+		m_IsModified = !fileStream.good();
+
+		return !m_IsModified;
+	}
+
+	void ConvolutionTuner::Tune( Convolution2D& _layer )
+	{
+		const std::string key = GetKey( _layer );
+		auto it = m_Plans.find( key );
+
+		//Plans of a file edited by hand, or of another version of the layer, may not fit
+		if( (it != m_Plans.end()) && _layer.IsAlgorithmSupported( it->second.Algorithm ) )
+		{
+			_layer.SetAlgorithm( it->second.Algorithm, it->second.NumThreads );
+			++m_NumHits;
+			return;
+		}
+
+		Plan plan = Measure( _layer );
+		_layer.SetAlgorithm( plan.Algorithm, plan.NumThreads );
+
+		Log( "Tuned %s %dx%dx%d -> %dx%dx%d: %s, %d threads\n", _layer.GetName(),
+			 _layer.GetInputShape().m_SX, _layer.GetInputShape().m_SY, _layer.GetInputShape().m_SZ,
+			 _layer.GetOutputShape().m_SX, _layer.GetOutputShape().m_SY, _layer.GetOutputShape().m_SZ,
+			 GetAlgorithmName( plan.Algorithm ), plan.NumThreads );
+
+		m_Plans[key] = plan;
+		m_IsModified = true;
+		++m_NumMisses;
+	}
+
+	std::string ConvolutionTuner::GetKey( const Convolution2D& _layer ) const
+	{
+		const TensorShape& in = _layer.GetInputShape();
+		const TensorShape& out = _layer.GetOutputShape();
+
+		//The best thread count depends on the number of cores available, which can be limited per process
+		std::ostringstream key;
+		key << m_CpuName << '\t'
+			<< in.m_SX << 'x' << in.m_SY << 'x' << in.m_SZ << 'p' << in.m_Padding << '-'
+			<< out.m_SX << 'x' << out.m_SY << 'x' << out.m_SZ << 'p' << out.m_Padding
+			<< "-k" << _layer.GetKernelSize() << "-s" << _layer.GetStride() << "-d" << _layer.GetDilation()
+			<< "-t" << omp_get_max_threads();
+
+		return key.str();
+	}
+
+	ConvolutionTuner::Plan ConvolutionTuner::Measure( Convolution2D& _layer ) const
+	{
+		const int numRuns = 3;
+
+		//Timings don't depend on the values, a generator of its own leaves g_Random (weight initialization, shuffling) untouched
+		CounterBasedRandom random( 0, 0 );
+
+		Tensor in( _layer.GetInputShape().Size() ), out( _layer.GetOutputShape().Size() ), scratch;
+
+		for( Scalar& s : in )
+			s = random.UniformDistribution( -1.0, 1.0 );
+
+		//Powers of two and all the threads
+		std::vector< int > threadCounts;
+
+		for( int numThreads = 1 ; numThreads < omp_get_max_threads() ; numThreads *= 2 )
+			threadCounts.push_back( numThreads );
+
+		threadCounts.push_back( omp_get_max_threads() );
+
+		Plan best = { _layer.GetAlgorithm(), 0 };
+		double bestTime = std::numeric_limits< double >::max();
+
+		for( int algorithm = 0 ; algorithm < (int)ConvolutionAlgorithm::Count ; ++algorithm )
+		{
+			if( !_layer.IsAlgorithmSupported( (ConvolutionAlgorithm)algorithm ) )
+				continue;
+
+			for( int numThreads : threadCounts )
+			{
+				_layer.SetAlgorithm( (ConvolutionAlgorithm)algorithm, numThreads );
+				_layer.ForwardWithScratch( in, out, scratch ); //Warm up caches and allocate the scratch memory
+
+				double time = std::numeric_limits< double >::max();
+
+				for( int run = 0 ; run < numRuns ; ++run )
+				{
+					auto start = std::chrono::steady_clock::now();
+					_layer.ForwardWithScratch( in, out, scratch );
+					auto end = std::chrono::steady_clock::now();
+
+					time = std::min( time, std::chrono::duration< double >( end - start ).count() );
+				}
+
+				if( time < bestTime )
+				{
+					bestTime = time;
+					best = { (ConvolutionAlgorithm)algorithm, numThreads };
+				}
+			}
+		}
+
+		return best;
+	}
+
+	const char* ConvolutionTuner::GetAlgorithmName( ConvolutionAlgorithm _algorithm )
+	{
+		switch( _algorithm )
+		{
+			case ConvolutionAlgorithm::Direct: return "Direct";
+			case ConvolutionAlgorithm::Gemm1x1: return "Gemm1x1";
+			case ConvolutionAlgorithm::Stride2Phases: return "Stride2Phases";
+			case ConvolutionAlgorithm::Im2ColGemm: return "Im2ColGemm";
+			default: return "Unknown";
+		}
+	}
+
+	bool ConvolutionTuner::FindAlgorithm( const std::string& _name, ConvolutionAlgorithm& _algorithm )
+	{
+		for( int algorithm = 0 ; algorithm < (int)ConvolutionAlgorithm::Count ; ++algorithm )
+		{
+			if( _name == GetAlgorithmName( (ConvolutionAlgorithm)algorithm ) )
+			{
+				_algorithm = (ConvolutionAlgorithm)algorithm;
+				return true;
+			}
+		}
+
+		return false;
+	}
+}
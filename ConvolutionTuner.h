@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Layers/Convolution2DLayer.h"
+#include <map>
+#include <string>
+
+namespace ToyDNN
+{
+	//Picks the fastest algorithm and thread count of Convolution2D layers on this machine by timing their forward pass.
+	//Results are kept in a text file keyed by CPU name and layer shape, so a layer is only measured the first time its shape is seen
+	//on a CPU. Entries of other CPUs are preserved, one file can be shared between machines. Not thread-safe.
+	class ConvolutionTuner
+	{
+	public:
+		explicit ConvolutionTuner( const char* _cacheFilename );
+
+		//Apply the cached plan of the layer shape, or measure and cache it
+		void Tune( Convolution2D& _layer );
+
+		//Write the cache file, if something was measured since it was loaded
+		bool Save();
+
+		uint32_t GetNumHits() const { return m_NumHits; }
+		uint32_t GetNumMisses() const { return m_NumMisses; }
+
+	private:
+		struct Plan
+		{
+			ConvolutionAlgorithm Algorithm;
+			int NumThreads; //0 for all of them
+		};
+
+		void Load();
+		std::string GetKey( const Convolution2D& _layer ) const;
+		Plan Measure( Convolution2D& _layer ) const;
+
+		static const char* GetAlgorithmName( ConvolutionAlgorithm _algorithm );
+		static bool FindAlgorithm( const std::string& _name, ConvolutionAlgorithm& _algorithm );
+
+	private:
+		std::string m_Filename;
+		std::string m_CpuName;
+		std::map< std::string, Plan > m_Plans; //CPU name and layer shape, separated by tabs
+		bool m_IsModified = false;
+
+		uint32_t m_NumHits = 0, m_NumMisses = 0;
+	};
+}
@@ -0,0 +1,207 @@
+#include "pch.h"
+#include "DataAugmentation.h"
+
+#undef min
+#undef max
+#include <algorithm>
+
+namespace ToyDNN
+{
+	void RandomCrop::Apply( Tensor& _sample, const TensorShape& _shape, CounterBasedRandom& _random ) const
+	{
+		assert( _sample.size() == _shape.Size() );
+
+		int shiftX = (int)_random.UniformInt( 2 * m_MaxShift + 1 ) - (int)m_MaxShift;
+		int shiftY = (int)_random.UniformInt( 2 * m_MaxShift + 1 ) - (int)m_MaxShift;
+
+		if( (shiftX == 0) && (shiftY == 0) )
+			return;
+
+		thread_local Tensor source;
+		source = _sample;
+
+		const int sx = (int)_shape.m_SX;
+		const int sy = (int)_shape.m_SY;
+
+		//Range of destination pixels which have a source pixel
+		const int x0 = std::max( 0, shiftX ), x1 = std::min( sx, sx + shiftX );
+		const int y0 = std::max( 0, shiftY ), y1 = std::min( sy, sy + shiftY );
+
+		std::fill( _sample.begin(), _sample.end(), m_FillValue );
+
+		if( (x0 >= x1) || (y0 >= y1) )
+			return;
+
+		for( uint32_t z = 0 ; z < _shape.m_SZ ; ++z )
+		{
+			for( int y = y0 ; y < y1 ; ++y )
+			{
+				memcpy( &_sample[_shape.Index( x0, y, z )], &source[_shape.Index( x0 - shiftX, y - shiftY, z )], (x1 - x0) * sizeof( Scalar ) );
+			}
+		}
+	}
+
+	void HorizontalFlip::Apply( Tensor& _sample, const TensorShape& _shape, CounterBasedRandom& _random ) const
+	{
+		assert( _sample.size() == _shape.Size() );
+
+		if( _random.UniformDistribution( Scalar( 0 ), Scalar( 1 ) ) >= m_Probability )
+			return;
+
+		for( uint32_t z = 0 ; z < _shape.m_SZ ; ++z )
+		{
+			for( uint32_t y = 0 ; y < _shape.m_SY ; ++y )
+			{
+				Scalar* row = &_sample[_shape.Index( 0, y, z )];
+				std::reverse( row, row + _shape.m_SX );
+			}
+		}
+	}
+
+	void BrightnessContrastJitter::Apply( Tensor& _sample, const TensorShape& _shape, CounterBasedRandom& _random ) const
+	{
+		Scalar brightness = _random.UniformDistribution( -m_MaxBrightness, m_MaxBrightness );
+		Scalar contrast = _random.UniformDistribution( Scalar( 1 ) - m_MaxContrast, Scalar( 1 ) + m_MaxContrast );
+
+		const uint32_t n = (uint32_t)_sample.size();
+		Scalar* data = &_sample[0];
+
+		Scalar mean = Scalar( 0 );
+
+		for( uint32_t i = 0 ; i < n ; ++i )
+			mean += data[i];
+
+		mean /= Scalar( n );
+
+		//out = in * contrast + offset, a single multiply add per element
+		const Scalar offset = mean * (Scalar( 1 ) - contrast) + brightness;
+
+		for( uint32_t i = 0 ; i < n ; ++i )
+			data[i] = data[i] * contrast + offset;
+	}
+
+	//===========================================================
+
+	AugmentationPipeline::AugmentationPipeline( const TensorShape& _sampleShape, uint32_t _numThreads, uint64_t _seed ) :
+		m_SampleShape( _sampleShape ),
+		m_OutputShape( _sampleShape ),
+		m_Seed( _seed ),
+		m_ThreadPool( _numThreads )
+	{
+	}
+
+	AugmentationPipeline::~AugmentationPipeline()
+	{
+		Wait( m_Batches[0] );
+		Wait( m_Batches[1] );
+	}
+
+	void AugmentationPipeline::AddAugmentation( DataAugmentation* _augmentation )
+	{
+		m_Augmentations.push_back( std::unique_ptr< DataAugmentation >( _augmentation ) );
+	}
+
+	void AugmentationPipeline::SetOutputPadding( uint32_t _padding )
+	{
+		Wait( m_Batches[0] );
+		Wait( m_Batches[1] );
+
+		//Invalidate batches that were augmented with the previous layout
+		m_Batches[0].DataSet = nullptr;
+		m_Batches[1].DataSet = nullptr;
+
+		m_OutputShape = TensorShape( m_SampleShape.m_SX + _padding, m_SampleShape.m_SY + _padding, m_SampleShape.m_SZ, _padding );
+	}
+
+	const std::vector< Tensor >& AugmentationPipeline::GetBatch( const std::vector< Tensor >& _dataSet, uint32_t _epoch, uint32_t _firstSample, uint32_t _numSamples )
+	{
+		Batch* batch = nullptr;
+
+		for( uint32_t i = 0 ; i < 2 ; ++i )
+		{
+			if( m_Batches[i].Matches( _dataSet, _epoch, _firstSample, _numSamples ) )
+			{
+				m_CurrentBatch = i;
+				batch = &m_Batches[i];
+				break;
+			}
+		}
+
+		if( batch == nullptr )
+		{
+			//Not prefetched, reuse the other slot so that the batch returned by the previous call stays valid until now
+			m_CurrentBatch = 1 - m_CurrentBatch;
+			batch = &m_Batches[m_CurrentBatch];
+			Schedule( *batch, _dataSet, _epoch, _firstSample, _numSamples );
+		}
+
+		Wait( *batch );
+
+		return batch->Samples;
+	}
+
+	void AugmentationPipeline::Prefetch( const std::vector< Tensor >& _dataSet, uint32_t _epoch, uint32_t _firstSample, uint32_t _numSamples )
+	{
+		Batch& batch = m_Batches[1 - m_CurrentBatch];
+
+		if( batch.Matches( _dataSet, _epoch, _firstSample, _numSamples ) )
+			return;
+
+		Schedule( batch, _dataSet, _epoch, _firstSample, _numSamples );
+	}
+
+	void AugmentationPipeline::Schedule( Batch& _batch, const std::vector< Tensor >& _dataSet, uint32_t _epoch, uint32_t _firstSample, uint32_t _numSamples )
+	{
+		assert( _firstSample + _numSamples <= _dataSet.size() );
+
+		Wait( _batch );
+
+		_batch.DataSet = &_dataSet;
+		_batch.Epoch = _epoch;
+		_batch.FirstSample = _firstSample;
+		_batch.NumSamples = _numSamples;
+		_batch.Samples.resize( _numSamples );
+
+		//A few jobs per thread to balance the load without too much scheduling overhead
+		const uint32_t numJobs = std::min( _numSamples, m_ThreadPool.GetNumThreads() * 4 );
+
+		for( uint32_t job = 0 ; job < numJobs ; ++job )
+		{
+			uint32_t begin = (uint32_t)(((uint64_t)_numSamples * job) / numJobs);
+			uint32_t end = (uint32_t)(((uint64_t)_numSamples * (job + 1)) / numJobs);
+
+			_batch.PendingJobs.push_back( m_ThreadPool.Enqueue( [this, &_batch, begin, end]() { AugmentSamples( _batch, begin, end ); } ) );
+		}
+	}
+
+	void AugmentationPipeline::Wait( Batch& _batch )
+	{
+		for( auto& job : _batch.PendingJobs )
+			job.wait();
+
+		_batch.PendingJobs.clear();
+	}
+
+	void AugmentationPipeline::AugmentSamples( Batch& _batch, uint32_t _begin, uint32_t _end ) const
+	{
+		const bool padOutput = m_OutputShape.m_Padding > 0;
+		thread_local Tensor unpaddedSample;
+
+		for( uint32_t i = _begin ; i < _end ; ++i )
+		{
+			uint32_t sampleIndex = _batch.FirstSample + i;
+			Tensor& sample = padOutput ? unpaddedSample : _batch.Samples[i];
+
+			sample = (*_batch.DataSet)[sampleIndex];
+			assert( sample.size() == m_SampleShape.Size() );
+
+			CounterBasedRandom random( m_Seed, ((uint64_t)_batch.Epoch << 32) | sampleIndex );
+
+			for( const auto& augmentation : m_Augmentations )
+				augmentation->Apply( sample, m_SampleShape, random );
+
+			if( padOutput )
+				CopyToPaddedTensor( sample, m_OutputShape, _batch.Samples[i] );
+		}
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "Tensor.h"
+#include "Util.h"
+#include "ThreadPool.h"
+#include <memory>
+
+namespace ToyDNN
+{
+	class DataAugmentation
+	{
+	public:
+		virtual ~DataAugmentation() {}
+
+		//Called from worker threads, must not modify the augmentation itself
+		virtual void Apply( Tensor& _sample, const TensorShape& _shape, CounterBasedRandom& _random ) const = 0;
+	};
+
+	//Random translation of up to _maxShift pixels, uncovered pixels are set to _fillValue
+	//Same thing as padding the image by _maxShift and randomly cropping it back to its original size
+	class RandomCrop : public DataAugmentation
+	{
+	public:
+		RandomCrop( uint32_t _maxShift, Scalar _fillValue = Scalar( 0 ) ) : m_MaxShift( _maxShift ), m_FillValue( _fillValue ) {}
+
+		virtual void Apply( Tensor& _sample, const TensorShape& _shape, CounterBasedRandom& _random ) const override;
+
+	private:
+		uint32_t m_MaxShift;
+		Scalar m_FillValue;
+	};
+
+	class HorizontalFlip : public DataAugmentation
+	{
+	public:
+		HorizontalFlip( Scalar _probability = Scalar( 0.5 ) ) : m_Probability( _probability ) {}
+
+		virtual void Apply( Tensor& _sample, const TensorShape& _shape, CounterBasedRandom& _random ) const override;
+
+	private:
+		Scalar m_Probability;
+	};
+
+	//out = (in - mean) * contrast + mean + brightness
+	//with contrast in [1-_maxContrast, 1+_maxContrast] and brightness in [-_maxBrightness, _maxBrightness]
+	class BrightnessContrastJitter : public DataAugmentation
+	{
+	public:
+		BrightnessContrastJitter( Scalar _maxBrightness, Scalar _maxContrast ) : m_MaxBrightness( _maxBrightness ), m_MaxContrast( _maxContrast ) {}
+
+		virtual void Apply( Tensor& _sample, const TensorShape& _shape, CounterBasedRandom& _random ) const override;
+
+	private:
+		Scalar m_MaxBrightness, m_MaxContrast;
+	};
+
+	//===========================================================
+
+	//Augments training batches on worker threads, while the trainer consumes the previous batch.
+	//Each sample draws its random numbers from its own counter based stream (seed, epoch, sample index),
+	//so augmented batches don't depend on the number of threads.
+	class AugmentationPipeline
+	{
+	public:
+		AugmentationPipeline( const TensorShape& _sampleShape, uint32_t _numThreads = 0, uint64_t _seed = 0 );
+		~AugmentationPipeline();
+
+		void AddAugmentation( DataAugmentation* _augmentation );
+
+		//Emit samples in the padded layout of a network compiled with pre-padded inputs, augmentations still work on unpadded samples
+		void SetOutputPadding( uint32_t _padding );
+
+		//Return the augmented copy of _dataSet[_firstSample, _firstSample + _numSamples[, blocks until it is ready
+		//The returned batch stays valid until the next call
+		const std::vector< Tensor >& GetBatch( const std::vector< Tensor >& _dataSet, uint32_t _epoch, uint32_t _firstSample, uint32_t _numSamples );
+
+		//Start augmenting a batch in the background, so that a later GetBatch() with the same parameters doesn't wait
+		void Prefetch( const std::vector< Tensor >& _dataSet, uint32_t _epoch, uint32_t _firstSample, uint32_t _numSamples );
+
+	private:
+		struct Batch
+		{
+			const std::vector< Tensor >* DataSet = nullptr;
+			uint32_t Epoch = 0, FirstSample = 0, NumSamples = 0;
+
+			std::vector< Tensor > Samples;
+			std::vector< std::future< void > > PendingJobs;
+
+			bool Matches( const std::vector< Tensor >& _dataSet, uint32_t _epoch, uint32_t _firstSample, uint32_t _numSamples ) const
+			{
+				return (DataSet == &_dataSet) && (Epoch == _epoch) && (FirstSample == _firstSample) && (NumSamples == _numSamples);
+			}
+		};
+
+		void Schedule( Batch& _batch, const std::vector< Tensor >& _dataSet, uint32_t _epoch, uint32_t _firstSample, uint32_t _numSamples );
+		void Wait( Batch& _batch );
+		void AugmentSamples( Batch& _batch, uint32_t _begin, uint32_t _end ) const;
+
+	private:
+		TensorShape m_SampleShape;
+		TensorShape m_OutputShape;
+		uint64_t m_Seed;
+		std::vector< std::unique_ptr< DataAugmentation > > m_Augmentations;
+
+		Batch m_Batches[2]; //The one being consumed by the trainer, and the one being prefetched
+		uint32_t m_CurrentBatch = 0;
+
+		ThreadPool m_ThreadPool;
+	};
+}
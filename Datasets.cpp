@@ -263,98 +263,146 @@ namespace ToyDNN
 	}
 #pragma endregion
 
-#pragma region MNIST
-
-	//Code borrowed from tiny_dnn
+#pragma region SampleView
 
-	struct mnist_header
+	void ConvertToTensor( const SampleView& _sample, Scalar _scaleMin, Scalar _scaleMax, Tensor& _tensor,
+						  uint32_t _xPadding, uint32_t _yPadding )
 	{
-		uint32_t magic_number;
-		uint32_t num_items;
-		uint32_t num_rows;
-		uint32_t num_cols;
-	};
+		const Scalar scale = (_scaleMax - _scaleMin) / Scalar( 255 );
+		const uint8_t* src = _sample.Data;
 
-	bool ParseMnistHeader( std::ifstream& ifs, mnist_header& header )
-	{
-		ifs.read( reinterpret_cast<char*>(&header.magic_number), 4 );
-		ifs.read( reinterpret_cast<char*>(&header.num_items), 4 );
-		ifs.read( reinterpret_cast<char*>(&header.num_rows), 4 );
-		ifs.read( reinterpret_cast<char*>(&header.num_cols), 4 );
+		if( (_xPadding == 0) && (_yPadding == 0) )
+		{
+			//Flat loop, simple enough for the compiler to vectorize
+			const uint32_t n = _sample.Shape.Size();
+			_tensor.resize( n );
+			Scalar* dst = &_tensor[0];
 
-		if( is_little_endian() )
+			for( uint32_t i = 0 ; i < n ; ++i )
+			{
+				dst[i] = (Scalar)src[i] * scale + _scaleMin;
+			}
+
+			return;
+		}
+
+		const uint32_t width = _sample.Shape.m_SX + 2 * _xPadding;
+		const uint32_t height = _sample.Shape.m_SY + 2 * _yPadding;
+
+		_tensor.assign( width * height * _sample.Shape.m_SZ, _scaleMin );
+
+		for( uint32_t z = 0 ; z < _sample.Shape.m_SZ ; ++z )
 		{
-			reverse_endian( &header.magic_number );
-			reverse_endian( &header.num_items );
-			reverse_endian( &header.num_rows );
-			reverse_endian( &header.num_cols );
+			for( uint32_t y = 0 ; y < _sample.Shape.m_SY ; ++y )
+			{
+				Scalar* dst = &_tensor[width * (height * z + y + _yPadding) + _xPadding];
+
+				for( uint32_t x = 0 ; x < _sample.Shape.m_SX ; ++x )
+				{
+					dst[x] = (Scalar)src[x] * scale + _scaleMin;
+				}
+
+				src += _sample.Shape.m_SX;
+			}
 		}
+	}
 
-		if( header.magic_number != 0x00000803 || header.num_items <= 0 )
-			return false;
+#pragma endregion
 
-		if( ifs.fail() || ifs.bad() )
-			return false;
+#pragma region MNIST
 
-		return true;
+	//Mnist data is big-endian format
+	inline uint32_t ReadBigEndianUInt32( const uint8_t* _data )
+	{
+		uint32_t v;
+		memcpy( &v, _data, sizeof( v ) );
+
+		if( is_little_endian() )
+			reverse_endian( &v );
+
+		return v;
 	}
 
-	bool LoadMnistImage( std::ifstream& ifs,
-						 const mnist_header& header,
-						 float_t scale_min,
-						 float_t scale_max,
-						 int x_padding,
-						 int y_padding,
-						 Tensor& dst )
+	bool MnistImageFile::Open( const char* _filename )
 	{
-		const int width = header.num_cols + 2 * x_padding;
-		const int height = header.num_rows + 2 * y_padding;
+		const uint32_t headerSize = 16;
 
-		std::vector<uint8_t> image_vec( header.num_rows * header.num_cols );
+		if( !m_File.Open( _filename ) || (m_File.GetSize() < headerSize) )
+			return false;
 
-		ifs.read( reinterpret_cast<char*>(&image_vec[0]),
-				  header.num_rows * header.num_cols );
+		const uint8_t* header = m_File.GetData();
 
-		dst.resize( width * height, scale_min );
+		uint32_t magicNumber = ReadBigEndianUInt32( header );
+		uint32_t numItems = ReadBigEndianUInt32( header + 4 );
+		uint32_t numRows = ReadBigEndianUInt32( header + 8 );
+		uint32_t numCols = ReadBigEndianUInt32( header + 12 );
 
-		for( uint32_t y = 0; y < header.num_rows; y++ )
-			for( uint32_t x = 0; x < header.num_cols; x++ )
-				dst[width * (y + y_padding) + x + x_padding] =
-				(image_vec[y * header.num_cols + x] / float_t( 255 )) *
-				(scale_max - scale_min) +
-				scale_min;
+		if( magicNumber != 0x00000803 || numItems == 0 )
+			return false;
+
+		if( m_File.GetSize() < headerSize + (size_t)numItems * numRows * numCols )
+			return false;
+
+		m_NumImages = numItems;
+		m_ImageShape = TensorShape( numCols, numRows, 1 );
 
 		return true;
 	}
 
-	bool LoadMnistLabels( const char* _filename, std::vector<Tensor>& _labels )
+	SampleView MnistImageFile::GetImage( uint32_t _index ) const
+	{
+		assert( _index < m_NumImages );
+
+		SampleView view;
+		view.Data = m_File.GetData() + 16 + (size_t)_index * m_ImageShape.Size();
+		view.Shape = m_ImageShape;
+		return view;
+	}
+
+	bool MnistLabelFile::Open( const char* _filename )
 	{
-		std::ifstream ifs( _filename, std::ios::in | std::ios::binary );
+		const uint32_t headerSize = 8;
 
-		if( ifs.bad() || ifs.fail() )
+		if( !m_File.Open( _filename ) || (m_File.GetSize() < headerSize) )
 			return false;
 
-		uint32_t magic_number, num_items;
+		uint32_t magicNumber = ReadBigEndianUInt32( m_File.GetData() );
+		uint32_t numItems = ReadBigEndianUInt32( m_File.GetData() + 4 );
 
-		ifs.read( reinterpret_cast<char*>(&magic_number), 4 );
-		ifs.read( reinterpret_cast<char*>(&num_items), 4 );
+		if( magicNumber != 0x00000801 || numItems == 0 )
+			return false;
 
-		if( is_little_endian() )
-		{  // Mnist data is big-endian format
-			reverse_endian( &magic_number );
-			reverse_endian( &num_items );
-		}
+		if( m_File.GetSize() < headerSize + (size_t)numItems )
+			return false;
 
-		if( magic_number != 0x00000801 || num_items <= 0 )
+		m_NumLabels = numItems;
+
+		return true;
+	}
+
+	uint8_t MnistLabelFile::GetLabel( uint32_t _index ) const
+	{
+		assert( _index < m_NumLabels );
+		return m_File.GetData()[8 + _index];
+	}
+
+	bool LoadMnistLabels( const char* _filename, std::vector<Tensor>& _labels )
+	{
+		MnistLabelFile file;
+
+		if( !file.Open( _filename ) )
 			return false;
 
-		_labels.resize( num_items );
-		for( uint32_t i = 0; i < num_items; i++ )
+		_labels.resize( file.GetNumLabels() );
+
+		for( uint32_t i = 0; i < file.GetNumLabels(); i++ )
 		{
-			uint8_t label;
-			ifs.read( reinterpret_cast<char*>(&label), 1 );
+			uint8_t label = file.GetLabel( i );
 
-			_labels[i].resize( 10, 0 );
+			if( label >= 10 )
+				return false;
+
+			_labels[i].assign( 10, 0 );
 			_labels[i][label] = 1;
 		}
 
@@ -398,20 +446,17 @@ namespace ToyDNN
 		if( scale_min >= scale_max )
 			return false;
 
-		std::ifstream ifs( _filename, std::ios::in | std::ios::binary );
+		MnistImageFile file;
 
-		if( ifs.bad() || ifs.fail() )
+		if( !file.Open( _filename ) )
 			return false;
 
-		mnist_header header;
-		if( !ParseMnistHeader( ifs, header ) )
-			return false;
+		_images.resize( file.GetNumImages() );
 
-		_images.resize( header.num_items );
-		for( uint32_t i = 0; i < header.num_items; i++ )
+		#pragma omp parallel for
+		for( int i = 0; i < (int)file.GetNumImages(); i++ )
 		{
-			if( !LoadMnistImage( ifs, header, scale_min, scale_max, x_padding, y_padding, _images[i] ) )
-				return false;
+			ConvertToTensor( file.GetImage( i ), scale_min, scale_max, _images[i], x_padding, y_padding );
 		}
 
 		return true;
@@ -456,43 +501,72 @@ namespace ToyDNN
 
 #pragma region CIFAR10
 
+	bool Cifar10File::Open( const char* _filename )
+	{
+		if( !m_File.Open( _filename ) )
+			return false;
+
+		if( m_File.GetSize() % RecordSize != 0 )
+			return false;
+
+		m_NumSamples = (uint32_t)(m_File.GetSize() / RecordSize);
+
+		return true;
+	}
+
+	SampleView Cifar10File::GetImage( uint32_t _index ) const
+	{
+		assert( _index < m_NumSamples );
+
+		//Pixels are stored as R, G and B planes, which is already our Tensor layout
+		SampleView view;
+		view.Data = m_File.GetData() + (size_t)_index * RecordSize + 1;
+		view.Shape = TensorShape( ImageRes, ImageRes, 3 );
+		return view;
+	}
+
+	uint8_t Cifar10File::GetLabel( uint32_t _index ) const
+	{
+		assert( _index < m_NumSamples );
+		return m_File.GetData()[(size_t)_index * RecordSize];
+	}
+
 	bool LoadCifar10Dataset( const char* _filename,
 							 std::vector< Tensor >& _dataSet,
 							 std::vector< Tensor >& _metaData )
 	{
-		static const uint32_t numPixels = 32 * 32;
+		Cifar10File file;
 
-		std::ifstream ifs( _filename, std::ios::in | std::ios::binary );
-
-		if( ifs.fail() || ifs.bad() )
+		if( !file.Open( _filename ) )
 			return false;
 
-		uint8_t label;
-		uint8_t pixels[numPixels * 3];
-
-		Tensor image( numPixels * 3 );
-		Tensor labelTensor( 10 );
+		const size_t firstSample = _dataSet.size();
+		const uint32_t numSamples = file.GetNumSamples();
 
-		while( ifs.read( (char*)&label, 1 ) )
-		{
+		_dataSet.resize( firstSample + numSamples );
+		_metaData.resize( firstSample + numSamples );
 
-			if( !ifs.read( (char*)(&pixels[0]), numPixels * 3 ) )
-				break;
+		int numInvalidLabels = 0;
 
+		#pragma omp parallel for reduction(+:numInvalidLabels)
+		for( int i = 0 ; i < (int)numSamples ; ++i )
+		{
+			ConvertToTensor( file.GetImage( i ), Scalar( 0 ), Scalar( 1 ), _dataSet[firstSample + i] );
 
-			std::fill( labelTensor.begin(), labelTensor.end(), 0.0f );
-			labelTensor[label] = 1.0f;
+			uint8_t label = file.GetLabel( i );
 
-			for( uint32_t i = 0 ; i < numPixels * 3 ; ++i )
+			if( label < Cifar10File::NumClasses )
 			{
-				image[i] = (float)pixels[i] / 255.0f;
+				_metaData[firstSample + i].assign( Cifar10File::NumClasses, Scalar( 0 ) );
+				_metaData[firstSample + i][label] = Scalar( 1 );
+			}
+			else
+			{
+				++numInvalidLabels;
 			}
-
-			_dataSet.push_back( image );
-			_metaData.push_back( labelTensor );
 		}
 
-		return true;
+		return numInvalidLabels == 0;
 	}
 
 
@@ -508,7 +582,11 @@ namespace ToyDNN
 		if( !LoadCifar10Dataset( filename, _validationSetData, _validationSetMetaData ) )
 			return false;
 
-		for( int i = 0 ; i < 5 ; ++i )
+		const uint32_t numTrainingBatches = 5;
+		_trainingSetData.reserve( _trainingSetData.size() + numTrainingBatches * 10000 );
+		_trainingSetMetaData.reserve( _trainingSetMetaData.size() + numTrainingBatches * 10000 );
+
+		for( uint32_t i = 0 ; i < numTrainingBatches ; ++i )
 		{
 			sprintf_s( filename, "%s\\data_batch_%d.bin", _filepath, i + 1 );
 
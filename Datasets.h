@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Tensor.h"
+#include "Util.h"
 
 
 namespace ToyDNN
@@ -10,6 +11,66 @@ namespace ToyDNN
 
 	};
 
+	//Zero-copy view on a sample stored as 8 bit unsigned integers, in the same [z][y][x] layout as a Tensor
+	struct SampleView
+	{
+		const uint8_t* Data = nullptr;
+		TensorShape Shape;
+	};
+
+	//Convert [0,255] to [_scaleMin,_scaleMax], _xPadding and _yPadding borders are filled with _scaleMin
+	void ConvertToTensor( const SampleView& _sample, Scalar _scaleMin, Scalar _scaleMax, Tensor& _tensor,
+						  uint32_t _xPadding = 0, uint32_t _yPadding = 0 );
+
+	//Memory mapped MNIST idx3 image file (http://yann.lecun.com/exdb/mnist/)
+	class MnistImageFile
+	{
+	public:
+		bool Open( const char* _filename );
+
+		inline uint32_t GetNumImages() const { return m_NumImages; }
+		SampleView GetImage( uint32_t _index ) const;
+
+	private:
+		MemoryMappedFile m_File;
+		uint32_t m_NumImages = 0;
+		TensorShape m_ImageShape;
+	};
+
+	//Memory mapped MNIST idx1 label file
+	class MnistLabelFile
+	{
+	public:
+		bool Open( const char* _filename );
+
+		inline uint32_t GetNumLabels() const { return m_NumLabels; }
+		uint8_t GetLabel( uint32_t _index ) const;
+
+	private:
+		MemoryMappedFile m_File;
+		uint32_t m_NumLabels = 0;
+	};
+
+	//Memory mapped CIFAR-10 binary batch file (https://www.cs.toronto.edu/~kriz/cifar.html)
+	class Cifar10File
+	{
+	public:
+		static const uint32_t ImageRes = 32;
+		static const uint32_t NumClasses = 10;
+
+		bool Open( const char* _filename );
+
+		inline uint32_t GetNumSamples() const { return m_NumSamples; }
+		SampleView GetImage( uint32_t _index ) const;
+		uint8_t GetLabel( uint32_t _index ) const;
+
+	private:
+		static const uint32_t RecordSize = 1 + ImageRes * ImageRes * 3;
+
+		MemoryMappedFile m_File;
+		uint32_t m_NumSamples = 0;
+	};
+
 	bool LoadCelebADataset( const char* _filepath,
 							bool _halfRes,
 							float _trainingSetRatio, //e.g. 0.5 loads 50% of the database
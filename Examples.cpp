@@ -90,7 +90,7 @@ void BaseExample::DrawConvolutionLayerFeatures( CDC& _dc, uint32_t _layerIndex,
     //assert( m_NeuralNet.DbgGetLayer( _layerIndex )->GetType() == LayerType::Convolution2D );
 
     const TensorShape& convOutputShape = m_NeuralNet.DbgGetLayer( _layerIndex )->GetOutputShape();
-    const Tensor& convOutput = m_NeuralNet.DbgGetLayer( _layerIndex )->GetOutput();
+    const Tensor& convOutput = m_NeuralNet.DbgGetLayerOutput( _layerIndex );
 
     if( convOutput.empty() )
         return;
@@ -393,7 +393,7 @@ Example3::Example3()
         m_NeuralNet.AddLayer( new Relu() );
         m_NeuralNet.AddLayer( new FullyConnected( 10 ) );
         m_NeuralNet.AddLayer( new Sigmoid() );
-        m_NeuralNet.Compile( TensorShape( m_ImageRes, m_ImageRes, numChannels ) );
+        m_NeuralNet.Compile( TensorShape( m_ImageRes, m_ImageRes, numChannels ), true );
         m_NeuralNet.EnableClassificationAccuracyLog();
 
     #ifdef USE_CIFAR10_INSTEAD_OF_MNIST
@@ -406,7 +406,22 @@ Example3::Example3()
                                m_TrainingData, m_ValidationData, m_TrainingMetaData, m_ValidationMetaData ) )
             throw std::exception( "Can't load MNIST database" );
     #endif
+
+        //Training samples are padded by the augmentation pipeline
+        m_NeuralNet.PadDataSet( m_ValidationData );
     }
+
+    m_Augmentation.reset( new AugmentationPipeline( TensorShape( m_ImageRes, m_ImageRes, numChannels ) ) );
+    m_Augmentation->SetOutputPadding( m_NeuralNet.GetInputShape().m_Padding );
+#ifdef USE_CIFAR10_INSTEAD_OF_MNIST
+    m_Augmentation->AddAugmentation( new RandomCrop( 4 ) );
+    m_Augmentation->AddAugmentation( new HorizontalFlip() );
+    m_Augmentation->AddAugmentation( new BrightnessContrastJitter( 0.1f, 0.2f ) );
+#else
+    m_Augmentation->AddAugmentation( new RandomCrop( 2 ) ); //Digits must not be flipped
+#endif
+    m_NeuralNet.SetAugmentationPipeline( m_Augmentation.get() );
+
     m_UserDrawnDigit.resize( m_ImageRes * m_ImageRes, 0 );
 
 #if 0
@@ -448,8 +463,9 @@ void Example3::Train( const HyperParameters& _params )
 
 void Example3::Draw( CDC& _dc )
 {
-    Tensor out;
-    m_NeuralNet.Evaluate( m_UserDrawnDigit, out );
+    Tensor in, out;
+    m_NeuralNet.PadInput( m_UserDrawnDigit, in );
+    m_NeuralNet.EvaluateIncremental( in, out, m_UserDrawnDigitEvaluation );
     m_RecognizedDigit = GetMostProbableClassIndex( out );
         
     RECT r = { m_UserDrawDigitRect.left, m_UserDrawDigitRect.bottom, m_UserDrawDigitRect.right, m_UserDrawDigitRect.bottom + 30 };
@@ -460,9 +476,12 @@ void Example3::Draw( CDC& _dc )
     
     DrawUserDrawnDigit( _dc );
     
-    DrawConvolutionLayerKernels( _dc, 1, 5, 5, 6 );
-    DrawConvolutionLayerFeatures( _dc, 3, 5, 50, 4 );
-    DrawConvolutionLayerFeatures( _dc, 6, 5, 120, 4 );
+    //Networks compiled without pre-padded input start with an implicit padding layer
+    uint32_t firstLayer = m_NeuralNet.DbgGetLayer( 0 )->GetType() == LayerType::Padding ? 1 : 0;
+
+    DrawConvolutionLayerKernels( _dc, firstLayer, 5, 5, 6 );
+    DrawConvolutionLayerFeatures( _dc, firstLayer + 2, 5, 50, 4 );
+    DrawConvolutionLayerFeatures( _dc, firstLayer + 5, 5, 120, 4 );
 
     PlotLearningCurve( _dc, CRect( 10, 400, 800, 800 ) );
 
@@ -566,6 +585,7 @@ Example4::Example4()
     m_NeuralNet.AddLayer( new ConvolutionTranspose2D( 4, 3, 2 ) );
     m_NeuralNet.AddLayer( new Sigmoid() );
     m_NeuralNet.Compile( m_InputShape );
+    m_NeuralNet.EnableGradientCheckpointing( 640 * 1024 ); //Cached outputs would take about 900KB per sample
 
     if( !LoadCelebADataset( "D:\\Dev\\DeepLearning Datasets\\CelebA", halfRes, 5.0f, 0.02f,
                             m_TrainingData, m_ValidationData, m_TrainingMetaData, m_ValidationMetaData ) )
@@ -600,14 +620,17 @@ void Example4::Draw( CDC& _dc )
         DrawImage( _dc, m_ValidationData[i], m_InputShape, i * 180, 10, 2 );
 
         Tensor out;
-        m_NeuralNet.Evaluate( m_ValidationData[i], out );
+        m_InferenceCache.Evaluate( m_NeuralNet, m_ValidationData[i], out );
         DrawImage( _dc, out, m_InputShape, i * 180, 240, 2 );
     }
 
     PlotLearningCurve( _dc, CRect( 10, 800, 800, 1200 ) );
-    DrawConvolutionLayerFeatures( _dc, 2, 5, 480, 2 );
-    DrawConvolutionLayerFeatures( _dc, 5, 5, 590, 3 );
-    DrawConvolutionLayerFeatures( _dc, 8, 5, 670, 3 );
+    uint32_t firstLayer = m_NeuralNet.DbgGetLayer( 0 )->GetType() == LayerType::Padding ? 1 : 0;
+
+    //Only outputs read by back propagation are kept during training, i.e. post activation ones here
+    DrawConvolutionLayerFeatures( _dc, firstLayer + 1, 5, 480, 2 );
+    DrawConvolutionLayerFeatures( _dc, firstLayer + 5, 5, 590, 3 );
+    DrawConvolutionLayerFeatures( _dc, firstLayer + 7, 5, 670, 3 );
 
 }
 
@@ -664,6 +687,15 @@ Example5::Example5()
             throw std::exception( "Can't load MNIST database" );
     #endif
     }
+
+    m_Augmentation.reset( new AugmentationPipeline( m_InputShape ) );
+#ifdef USE_CIFAR10_INSTEAD_OF_MNIST
+    m_Augmentation->AddAugmentation( new HorizontalFlip() );
+    m_Augmentation->AddAugmentation( new BrightnessContrastJitter( 0.1f, 0.2f ) );
+#else
+    m_Augmentation->AddAugmentation( new RandomCrop( 2 ) );
+#endif
+    m_NeuralNet.SetAugmentationPipeline( m_Augmentation.get() );
 }
 
 void Example5::GradientCheck()
@@ -698,14 +730,83 @@ void Example5::Draw( CDC& _dc )
         DrawImage( _dc, m_ValidationData[i], m_InputShape, i * 100, 10, 3 );
         
         Tensor out;
-        m_NeuralNet.Evaluate( m_ValidationData[i], out );
+        m_InferenceCache.Evaluate( m_NeuralNet, m_ValidationData[i], out );
         DrawImage( _dc, out, m_InputShape, i * 100, 120, 3 );
     }
 
-    DrawConvolutionLayerKernels( _dc, 1, 5, 250, 6 );
-    DrawConvolutionLayerKernels( _dc, 3, 5, 290, 6 );
+    //Models saved before padding was handled by the layers start with a PaddingLayer
+    uint32_t firstLayer = m_NeuralNet.DbgGetLayer( 0 )->GetType() == LayerType::Padding ? 1 : 0;
+
+    DrawConvolutionLayerKernels( _dc, firstLayer, 5, 250, 6 );
+    DrawConvolutionLayerKernels( _dc, firstLayer + 2, 5, 290, 6 );
 
-    DrawConvolutionLayerFeatures( _dc, 1, 5, 320, 3 );
-    DrawConvolutionLayerFeatures( _dc, 3, 5, 450, 3 );
+    //Only outputs read by back propagation are kept during training, i.e. post activation ones here
+    DrawConvolutionLayerFeatures( _dc, firstLayer + 1, 5, 320, 3 );
+    DrawConvolutionLayerFeatures( _dc, firstLayer + 3, 5, 450, 3 );
+
+}
 
+//-----------------------------------------
+
+
+Example6::Example6()
+{
+    srand( 666 );
+
+    if( !m_Registry.Load( m_NeuralNetFilename ) )
+    {
+        Log( "Example6: %s not found, serving a network with random weights\n", m_NeuralNetFilename );
+
+        std::shared_ptr< NeuralNetwork > network = std::make_shared< NeuralNetwork >();
+        network->AddLayer( new Convolution2D( 16, 3, 1 ) );
+        network->AddLayer( new Relu() );
+        network->AddLayer( new MaxPooling( 2, 2 ) );
+        network->AddLayer( new Convolution2D( 64, 3, 1 ) );
+        network->AddLayer( new Relu() );
+        network->AddLayer( new MaxPooling( 2, 2 ) );
+        network->AddLayer( new FullyConnected( 500 ) );
+        network->AddLayer( new Relu() );
+        network->AddLayer( new FullyConnected( 10 ) );
+        network->AddLayer( new Sigmoid() );
+        network->Compile( TensorShape( 28, 28, 1 ) );
+        m_Registry.Publish( network );
+    }
+
+    //The served model only matters for its input size here, any image will do
+    const uint32_t inputSize = m_Registry.Acquire()->GetInputShape().Size();
+    m_Samples.resize( 64 );
+    for( Tensor& sample : m_Samples )
+    {
+        sample.resize( inputSize );
+        for( Scalar& value : sample )
+            value = Scalar( rand() ) / RAND_MAX;
+    }
+
+    m_Server.reset( new InferenceServer( m_Registry ) );
+    if( !m_Server->Start( m_SocketPath ) )
+        throw std::exception( "Can't start the inference server" );
+}
+
+void Example6::Train( const HyperParameters& _params )
+{
+    //RunLoadTest() logs its report
+    LoadTestReport report = RunLoadTest( m_SocketPath, m_Samples, m_NumClients, m_NumRequestsPerClient );
+
+    std::lock_guard< std::mutex > lock( m_ReportMutex );
+    m_LastReport = report;
+    ++m_NumLoadTests;
+}
+
+void Example6::Draw( CDC& _dc )
+{
+    std::lock_guard< std::mutex > lock( m_ReportMutex );
+
+    TCHAR buffer[256];
+    if( m_NumLoadTests == 0 )
+        _stprintf_s( buffer, _T("Start training to run the load test: %d clients, %d requests each"), m_NumClients, m_NumRequestsPerClient );
+    else
+        _stprintf_s( buffer, _T("Load test #%d: %d requests (%d failed), %.0f requests/s, latency p50 %.3fms p99 %.3fms"),
+                     m_NumLoadTests, m_LastReport.NumRequests, m_LastReport.NumFailedRequests, m_LastReport.RequestsPerSecond,
+                     m_LastReport.P50LatencyMilliseconds, m_LastReport.P99LatencyMilliseconds );
+    _dc.DrawText( buffer, -1, &CRect( 10, 10, 800, 50 ), DT_LEFT );
 }
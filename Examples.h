@@ -2,6 +2,10 @@
 #include <windows.h>
 #include "NeuralNetwork.h"
 #include "Datasets.h"
+#include "DataAugmentation.h"
+#include "InferenceCache.h"
+#include "InferenceServer.h"
+#include <mutex>
 
 using namespace ToyDNN;
 
@@ -51,6 +55,7 @@ protected:
 protected:
 	HWND m_hWnd = 0;
 	NeuralNetwork m_NeuralNet;
+	InferenceCache m_InferenceCache; //Draw() evaluates the same samples at each repaint
 	bool m_IsTrainingPaused = false;
 	bool m_StopTraining = false;
 
@@ -135,8 +140,12 @@ private:
 	std::vector< Tensor > m_DebugData;
 	std::vector< Tensor > m_DebugMetaData;
 
+	//Declared after the datasets: destroyed first, it waits for the prefetch job still reading them
+	std::unique_ptr< AugmentationPipeline > m_Augmentation;
+
 	const CRect m_UserDrawDigitRect = { 900, 400, 1300, 800 };
 	Tensor m_UserDrawnDigit;
+	IncrementalEvaluationState m_UserDrawnDigitEvaluation; //Strokes only change a few pixels between repaints
 	uint32_t m_RecognizedDigit = 0;
 };
 
@@ -186,4 +195,31 @@ private:
 	TensorShape m_InputShape;
 	std::vector< Tensor > m_TrainingData;
 	std::vector< Tensor > m_ValidationData;
+	std::unique_ptr< AugmentationPipeline > m_Augmentation; //After the datasets, see Example3
+};
+
+//Inference server load test: serves the Example3 classifier (random weights if it wasn't saved yet) on a local socket,
+//each training round runs RunLoadTest() against it
+class Example6 : public BaseExample
+{
+public:
+	Example6();
+	virtual ~Example6() {}
+
+	virtual void Train( const HyperParameters& _params ) override;
+	virtual void Draw( CDC& _dc ) override;
+
+private:
+	const char* m_NeuralNetFilename = "D:/tmp/example3_mnist.dnn";
+	const char* m_SocketPath = "D:/tmp/toydnn_example6.sock";
+	static const uint32_t m_NumClients = 16;
+	static const uint32_t m_NumRequestsPerClient = 200;
+
+	ModelRegistry m_Registry;
+	std::unique_ptr< InferenceServer > m_Server; //Declared after the registry: stopped before the model it serves is released
+	std::vector< Tensor > m_Samples;
+
+	std::mutex m_ReportMutex; //Train() runs on the training thread, Draw() on the UI one
+	LoadTestReport m_LastReport;
+	uint32_t m_NumLoadTests = 0;
 };
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Tensor.h"
+#include "Util.h"
+#include <omp.h>
+#include <vector>
+
+namespace ToyDNN
+{
+	//Matrices are row major: element (i, j) of a matrix with leading dimension ld is at [i * ld + j]
+	struct MatrixView
+	{
+		const Scalar* Data;
+		uint32_t LD;
+		bool Transposed; //Read as its transpose, element (i, j) is then at [j * ld + i]
+
+		inline Scalar operator()( uint32_t _i, uint32_t _j ) const { return Transposed ? Data[_j * LD + _i] : Data[_i * LD + _j]; }
+	};
+
+	const uint32_t c_GemmBlockN = 256; //Columns of a panel of _b in Gemm()
+
+	//Tile of _c kept in registers while a panel of _b is streamed: each loaded element of _b feeds TileRows multiply-adds.
+	//_cols <= TileCols, the fixed size loops are unrolled and vectorized by the compiler for full tiles.
+	template< uint32_t TileRows, uint32_t TileCols >
+	inline void GemmTile( const MatrixView& _a, uint32_t _i, uint32_t _k0, uint32_t _k1, const Scalar* _panel, uint32_t _panelLD,
+						  Scalar* _c, uint32_t _ldc, uint32_t _rows, uint32_t _cols )
+	{
+		Scalar accum[TileRows][TileCols] = {};
+
+		//Element (i, k) of _a is at [i * rowStride + k * colStride]
+		const uint32_t rowStride = _a.Transposed ? 1 : _a.LD;
+		const uint32_t colStride = _a.Transposed ? _a.LD : 1;
+		const Scalar* a = &_a.Data[_i * rowStride];
+
+		if( (_rows == TileRows) && (_cols == TileCols) )
+		{
+			for( uint32_t k = _k0 ; k < _k1 ; ++k )
+			{
+				const Scalar* b = &_panel[(k - _k0) * _panelLD];
+
+				for( uint32_t r = 0 ; r < TileRows ; ++r )
+				{
+					const Scalar ark = a[r * rowStride + k * colStride];
+
+					for( uint32_t j = 0 ; j < TileCols ; ++j )
+						accum[r][j] += ark * b[j];
+				}
+			}
+		}
+		else
+		{
+			for( uint32_t k = _k0 ; k < _k1 ; ++k )
+			{
+				const Scalar* b = &_panel[(k - _k0) * _panelLD];
+
+				for( uint32_t r = 0 ; r < _rows ; ++r )
+				{
+					const Scalar ark = a[r * rowStride + k * colStride];
+
+					for( uint32_t j = 0 ; j < _cols ; ++j )
+						accum[r][j] += ark * b[j];
+				}
+			}
+		}
+
+		for( uint32_t r = 0 ; r < _rows ; ++r )
+		{
+			for( uint32_t j = 0 ; j < _cols ; ++j )
+				_c[r * _ldc + j] += accum[r][j];
+		}
+	}
+
+	//_c[M x N] += _a[M x K] * _b[K x N]
+	//Blocked so that a panel of _b stays in cache while it is reused by every row of _c, and register tiled (see GemmTile()).
+	//A transposed _b is packed first so that panel rows are contiguous.
+	//Rows of _c are split between _numThreads threads (0 for all of them), each element is accumulated in the same order whatever the number of threads.
+	inline void Gemm( uint32_t _m, uint32_t _n, uint32_t _k, const MatrixView& _a, const MatrixView& _b, Scalar* _c, uint32_t _ldc, int _numThreads = 0 )
+	{
+		const uint32_t tileRows = 4, tileCols = 8;
+		const uint32_t blockN = c_GemmBlockN;
+		const uint32_t blockK = 128; //Rows of a panel, the panel stays in L2
+
+		const bool parallel = IsWorthParallelizing( (size_t)_m * _n * _k );
+		const int numThreads = !parallel ? 1 : (_numThreads > 0 ? _numThreads : omp_get_max_threads());
+
+		std::vector< Scalar > packedB;
+
+		for( uint32_t n0 = 0 ; n0 < _n ; n0 += blockN )
+		{
+			const uint32_t n1 = std::min( n0 + blockN, _n );
+
+			for( uint32_t k0 = 0 ; k0 < _k ; k0 += blockK )
+			{
+				const uint32_t k1 = std::min( k0 + blockK, _k );
+
+				const Scalar* panel;
+				uint32_t panelLD;
+
+				if( !_b.Transposed )
+				{
+					panel = &_b.Data[k0 * _b.LD + n0];
+					panelLD = _b.LD;
+				}
+				else
+				{
+					packedB.resize( (k1 - k0) * (n1 - n0) );
+
+					for( uint32_t k = k0 ; k < k1 ; ++k )
+					{
+						for( uint32_t j = n0 ; j < n1 ; ++j )
+							packedB[(k - k0) * (n1 - n0) + j - n0] = _b( k, j );
+					}
+
+					panel = packedB.data();
+					panelLD = n1 - n0;
+				}
+
+				#pragma omp parallel for schedule( static ) num_threads( numThreads )
+				for( int i = 0 ; i < (int)_m ; i += tileRows )
+				{
+					const uint32_t rows = std::min( tileRows, _m - i );
+
+					for( uint32_t j = n0 ; j < n1 ; j += tileCols )
+						GemmTile< tileRows, tileCols >( _a, i, k0, k1, &panel[j - n0], panelLD, &_c[i * _ldc + j], _ldc, rows, std::min( tileCols, n1 - j ) );
+				}
+			}
+		}
+	}
+}
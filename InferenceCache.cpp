@@ -0,0 +1,77 @@
+#include "pch.h"
+#include "InferenceCache.h"
+#include <cstring>
+#include <type_traits>
+
+namespace ToyDNN
+{
+	uint64_t InferenceCache::Hash( const Tensor& _tensor )
+	{
+		//Multiply-xorshift over the bit patterns of the scalars, one multiplication per element
+		uint64_t hash = 0x9E3779B97F4A7C15ull ^ _tensor.size();
+
+		//Unsigned integer of the size of a Scalar, float or double
+		typedef std::conditional< sizeof( Scalar ) == sizeof( uint64_t ), uint64_t, uint32_t >::type ScalarBits;
+		static_assert( sizeof( ScalarBits ) == sizeof( Scalar ), "Scalar is expected to be float or double" );
+
+		for( Scalar s : _tensor )
+		{
+			ScalarBits bits;
+			memcpy( &bits, &s, sizeof( bits ) );
+
+			hash = (hash ^ (uint64_t)bits) * 0xFF51AFD7ED558CCDull;
+			hash ^= hash >> 32;
+		}
+
+		return hash;
+	}
+
+	void InferenceCache::Evaluate( const NeuralNetwork& _network, const Tensor& _in, Tensor& _out )
+	{
+		//Read before evaluating: if training updates the weights meanwhile, the output is stored under the older version
+		const uint64_t weightsVersion = _network.GetWeightsVersion();
+
+		if( weightsVersion != m_WeightsVersion )
+		{
+			Clear();
+			m_WeightsVersion = weightsVersion;
+		}
+
+		const uint64_t hash = Hash( _in );
+		auto it = m_EntriesByHash.find( hash );
+
+		if( it != m_EntriesByHash.end() )
+		{
+			if( it->second->Input == _in )
+			{
+				m_Entries.splice( m_Entries.begin(), m_Entries, it->second );
+				_out = it->second->Output;
+				++m_NumHits;
+				return;
+			}
+
+			//Collision, the new input replaces the old one
+			m_Entries.erase( it->second );
+			m_EntriesByHash.erase( it );
+		}
+
+		++m_NumMisses;
+
+		_network.Evaluate( _in, _out, m_Workspace );
+
+		if( m_Entries.size() >= m_Capacity )
+		{
+			m_EntriesByHash.erase( m_Entries.back().Hash );
+			m_Entries.pop_back();
+		}
+
+		m_Entries.push_front( Entry{ hash, _in, _out } );
+		m_EntriesByHash[hash] = m_Entries.begin();
+	}
+
+	void InferenceCache::Clear()
+	{
+		m_Entries.clear();
+		m_EntriesByHash.clear();
+	}
+}
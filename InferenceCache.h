@@ -0,0 +1,45 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+#include <list>
+#include <unordered_map>
+
+namespace ToyDNN
+{
+	//Memoizes the outputs of a network for recently evaluated inputs, bounded by an LRU policy.
+	//Entries are tied to the weights version of the network (see NeuralNetwork::GetWeightsVersion()), they are all
+	//dropped as soon as the weights change, so one cache should be used with a single network. Not thread-safe.
+	class InferenceCache
+	{
+	public:
+		explicit InferenceCache( uint32_t _capacity = 64 ) : m_Capacity( _capacity ) { assert( _capacity > 0 ); }
+
+		//Return the cached output, or evaluate the network and cache its output
+		void Evaluate( const NeuralNetwork& _network, const Tensor& _in, Tensor& _out );
+
+		void Clear();
+
+		uint64_t GetNumHits() const { return m_NumHits; }
+		uint64_t GetNumMisses() const { return m_NumMisses; }
+
+		static uint64_t Hash( const Tensor& _tensor );
+
+	private:
+		struct Entry
+		{
+			uint64_t Hash;
+			Tensor Input; //Compared on lookup, hash collisions are never returned as hits
+			Tensor Output;
+		};
+
+		typedef std::list< Entry > EntryList;
+
+		uint32_t m_Capacity;
+		uint64_t m_WeightsVersion = 0;
+		EntryList m_Entries; //Most recently used first
+		std::unordered_map< uint64_t, EntryList::iterator > m_EntriesByHash;
+		EvaluationWorkspace m_Workspace;
+
+		uint64_t m_NumHits = 0, m_NumMisses = 0;
+	};
+}
@@ -0,0 +1,38 @@
+#include "pch.h"
+#include "InferenceContext.h"
+#include "ModelRegistry.h"
+
+namespace ToyDNN
+{
+	std::shared_ptr< const NeuralNetwork > LoadInferenceNetwork( const char* _filename )
+	{
+		std::shared_ptr< NeuralNetwork > network = std::make_shared< NeuralNetwork >();
+
+		if( !network->Load( _filename, true ) )
+			return nullptr;
+
+		return network;
+	}
+
+	InferenceContext::InferenceContext( std::shared_ptr< const NeuralNetwork > _network ) :
+		m_Network( std::move( _network ) )
+	{
+		assert( m_Network );
+	}
+
+	InferenceContext::InferenceContext( const ModelRegistry& _registry ) :
+		m_Network( _registry.Acquire() ),
+		m_Registry( &_registry )
+	{
+	}
+
+	void InferenceContext::Evaluate( const Tensor& _in, Tensor& _out )
+	{
+		if( m_Registry != nullptr )
+			m_Network = m_Registry->Acquire();
+
+		assert( m_Network ); //Nothing published yet
+
+		m_Network->Evaluate( _in, _out, m_Workspace );
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+#include <memory>
+
+namespace ToyDNN
+{
+	class ModelRegistry;
+
+	//Load a network for serving, its weights are then shared read-only by every InferenceContext referencing it
+	std::shared_ptr< const NeuralNetwork > LoadInferenceNetwork( const char* _filename );
+
+	//Executable instance of a shared network: one per worker thread.
+	//Weights are not copied, a context only owns the buffers used to evaluate the network.
+	class InferenceContext
+	{
+	public:
+		explicit InferenceContext( std::shared_ptr< const NeuralNetwork > _network );
+
+		//Follow the model published in _registry: each Evaluate() runs on the latest version, the previous one is released
+		explicit InferenceContext( const ModelRegistry& _registry );
+
+		void Evaluate( const Tensor& _in, Tensor& _out );
+
+		const NeuralNetwork& GetNetwork() const { return *m_Network; }
+		const std::shared_ptr< const NeuralNetwork >& GetSharedNetwork() const { return m_Network; }
+
+	private:
+		std::shared_ptr< const NeuralNetwork > m_Network; //Keeps the weights alive as long as a context uses them
+		const ModelRegistry* m_Registry = nullptr;
+		EvaluationWorkspace m_Workspace;
+	};
+}
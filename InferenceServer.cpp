@@ -0,0 +1,495 @@
+#include "pch.h"
+#include "InferenceServer.h"
+#include <winsock2.h>
+#include <afunix.h>
+#include <cstdio>
+
+#pragma comment( lib, "Ws2_32.lib" )
+
+#undef min
+#undef max
+#include <algorithm>
+
+namespace ToyDNN
+{
+	namespace
+	{
+		const uintptr_t InvalidSocket = (uintptr_t)INVALID_SOCKET;
+		const uint32_t MaxRequestValues = 64 * 1024 * 1024; //Sanity check against garbage headers
+
+		bool InitializeSockets()
+		{
+			WSADATA data;
+			return WSAStartup( MAKEWORD( 2, 2 ), &data ) == 0;
+		}
+
+		bool MakeAddress( const char* _socketPath, sockaddr_un& _address )
+		{
+			memset( &_address, 0, sizeof( _address ) );
+			_address.sun_family = AF_UNIX;
+
+			size_t length = strlen( _socketPath );
+
+			if( length >= sizeof( _address.sun_path ) )
+				return false;
+
+			memcpy( _address.sun_path, _socketPath, length );
+
+			return true;
+		}
+
+		bool SendAll( uintptr_t _socket, const void* _data, size_t _size )
+		{
+			const char* data = (const char*)_data;
+
+			while( _size > 0 )
+			{
+				int sent = send( (SOCKET)_socket, data, (int)std::min< size_t >( _size, 1 << 30 ), 0 );
+
+				if( sent <= 0 )
+					return false;
+
+				data += sent;
+				_size -= sent;
+			}
+
+			return true;
+		}
+
+		bool ReceiveAll( uintptr_t _socket, void* _data, size_t _size )
+		{
+			char* data = (char*)_data;
+
+			while( _size > 0 )
+			{
+				int received = recv( (SOCKET)_socket, data, (int)std::min< size_t >( _size, 1 << 30 ), 0 );
+
+				if( received <= 0 )
+					return false; //Closed or error
+
+				data += received;
+				_size -= received;
+			}
+
+			return true;
+		}
+	}
+
+	InferenceServer::InferenceServer( const ModelRegistry& _registry, const InferenceServerSettings& _settings ) :
+		m_Registry( _registry ),
+		m_Settings( _settings ),
+		m_ListenSocket( InvalidSocket )
+	{
+		assert( m_Settings.MaxBatchSize > 0 );
+	}
+
+	InferenceServer::~InferenceServer()
+	{
+		Stop();
+	}
+
+	bool InferenceServer::Start( const char* _socketPath )
+	{
+		assert( m_ListenSocket == InvalidSocket );
+
+		sockaddr_un address;
+
+		if( !MakeAddress( _socketPath, address ) || !InitializeSockets() )
+			return false;
+
+		SOCKET listenSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+		if( listenSocket == INVALID_SOCKET )
+		{
+			WSACleanup();
+			return false;
+		}
+
+		remove( _socketPath ); //Left over by a previous run
+
+		if( (bind( listenSocket, (const sockaddr*)&address, sizeof( address ) ) == SOCKET_ERROR) ||
+			(listen( listenSocket, SOMAXCONN ) == SOCKET_ERROR) )
+		{
+			Log( "InferenceServer: can't listen on %s\n", _socketPath );
+			closesocket( listenSocket );
+			WSACleanup();
+			return false;
+		}
+
+		m_ListenSocket = (uintptr_t)listenSocket;
+		m_Stop = false;
+		m_NumBatches = 0;
+		m_NumBatchedRequests = 0;
+
+		m_BatchThread = std::thread( &InferenceServer::BatchLoop, this );
+		m_AcceptThread = std::thread( &InferenceServer::AcceptLoop, this );
+
+		Log( "InferenceServer: listening on %s\n", _socketPath );
+
+		return true;
+	}
+
+	void InferenceServer::Stop()
+	{
+		if( m_ListenSocket == InvalidSocket )
+			return;
+
+		{
+			std::lock_guard< std::mutex > lock( m_QueueMutex );
+			m_Stop = true; //New requests are rejected from now on
+		}
+
+		m_QueueCondition.notify_all();
+
+		//Unblock accept()
+		shutdown( (SOCKET)m_ListenSocket, SD_BOTH );
+		closesocket( (SOCKET)m_ListenSocket );
+		m_AcceptThread.join();
+		m_ListenSocket = InvalidSocket;
+
+		//Unblock connections waiting for a request, connection threads close their own socket
+		std::list< Connection > connections;
+
+		{
+			std::lock_guard< std::mutex > lock( m_ConnectionsMutex );
+
+			for( Connection& connection : m_Connections )
+			{
+				if( !connection.Finished )
+					shutdown( (SOCKET)connection.Socket, SD_BOTH );
+			}
+
+			connections.splice( connections.end(), m_Connections ); //Nodes don't move, the pointers held by connection threads stay valid
+		}
+
+		for( Connection& connection : connections )
+			connection.Thread.join();
+
+		//Completes what is left in the queue
+		m_BatchThread.join();
+
+		WSACleanup();
+
+		if( m_NumBatches > 0 )
+			Log( "InferenceServer: stopped, %llu requests in %llu batches (%.1f requests per batch)\n",
+				 m_NumBatchedRequests, m_NumBatches, (double)m_NumBatchedRequests / (double)m_NumBatches );
+	}
+
+	std::future< InferenceResult > InferenceServer::Submit( Tensor _input )
+	{
+		Request request;
+		request.Input.swap( _input );
+		request.EnqueueTime = Clock::now();
+
+		std::future< InferenceResult > result = request.Promise.get_future();
+
+		{
+			std::lock_guard< std::mutex > lock( m_QueueMutex );
+
+			if( m_Stop || (m_Queue.size() >= m_Settings.MaxQueuedRequests) )
+			{
+				InferenceResult overloaded;
+				overloaded.Status = InferenceStatus::Overloaded;
+				request.Promise.set_value( std::move( overloaded ) );
+
+				return result;
+			}
+
+			m_Queue.push_back( std::move( request ) );
+		}
+
+		m_QueueCondition.notify_one();
+
+		return result;
+	}
+
+	void InferenceServer::AcceptLoop()
+	{
+		while( true )
+		{
+			SOCKET clientSocket = accept( (SOCKET)m_ListenSocket, nullptr, nullptr );
+
+			if( clientSocket == INVALID_SOCKET )
+				return; //Stopped
+
+			std::lock_guard< std::mutex > lock( m_ConnectionsMutex );
+
+			//Reclaim threads of closed connections
+			for( auto it = m_Connections.begin() ; it != m_Connections.end() ; )
+			{
+				if( it->Finished )
+				{
+					it->Thread.join();
+					it = m_Connections.erase( it );
+				}
+				else
+				{
+					++it;
+				}
+			}
+
+			m_Connections.emplace_back();
+			Connection& connection = m_Connections.back();
+			connection.Socket = (uintptr_t)clientSocket;
+			connection.Thread = std::thread( &InferenceServer::ServeConnection, this, &connection );
+		}
+	}
+
+	void InferenceServer::ServeConnection( Connection* _connection )
+	{
+		const uintptr_t clientSocket = _connection->Socket;
+
+		while( true )
+		{
+			uint32_t numValues;
+
+			if( !ReceiveAll( clientSocket, &numValues, sizeof( numValues ) ) || (numValues > MaxRequestValues) )
+				break;
+
+			Tensor input( numValues );
+
+			if( !ReceiveAll( clientSocket, input.data(), numValues * sizeof( Scalar ) ) )
+				break;
+
+			InferenceResult result = Submit( std::move( input ) ).get();
+
+			uint32_t header[2] = { (uint32_t)result.Status, (uint32_t)result.Output.size() };
+
+			if( !SendAll( clientSocket, header, sizeof( header ) ) ||
+				!SendAll( clientSocket, result.Output.data(), result.Output.size() * sizeof( Scalar ) ) )
+				break;
+		}
+
+		std::lock_guard< std::mutex > lock( m_ConnectionsMutex );
+		closesocket( (SOCKET)clientSocket );
+		_connection->Finished = true;
+	}
+
+	void InferenceServer::BatchLoop()
+	{
+		const auto maxDelay = std::chrono::microseconds( m_Settings.MaxBatchDelayMicroseconds );
+		std::vector< Request > batch;
+
+		while( true )
+		{
+			{
+				std::unique_lock< std::mutex > lock( m_QueueMutex );
+
+				m_QueueCondition.wait( lock, [this]() { return m_Stop || !m_Queue.empty(); } );
+
+				if( m_Queue.empty() )
+					return; //Stopped and drained
+
+				//Give the batch a chance to fill up, but don't make the oldest request wait more than maxDelay
+				const Clock::time_point deadline = m_Queue.front().EnqueueTime + maxDelay;
+				m_QueueCondition.wait_until( lock, deadline, [this]() { return m_Stop || (m_Queue.size() >= m_Settings.MaxBatchSize); } );
+
+				const size_t batchSize = std::min< size_t >( m_Queue.size(), m_Settings.MaxBatchSize );
+
+				for( size_t i = 0 ; i < batchSize ; ++i )
+				{
+					batch.push_back( std::move( m_Queue.front() ) );
+					m_Queue.pop_front();
+				}
+			}
+
+			RunBatch( batch );
+			batch.clear();
+		}
+	}
+
+	void InferenceServer::RunBatch( std::vector< Request >& _batch )
+	{
+		//The whole batch runs on the same model version, even if a new one is published meanwhile
+		std::shared_ptr< const NeuralNetwork > network = m_Registry.Acquire();
+
+		m_BatchInputs.clear();
+		std::vector< Request* > validRequests;
+
+		for( Request& request : _batch )
+		{
+			InferenceResult result;
+
+			if( !network )
+				result.Status = InferenceStatus::NoModel;
+			else if( request.Input.size() != network->GetInputShape().Size() )
+				result.Status = InferenceStatus::InvalidInput;
+			else
+			{
+				m_BatchInputs.push_back( &request.Input );
+				validRequests.push_back( &request );
+				continue;
+			}
+
+			request.Promise.set_value( std::move( result ) );
+		}
+
+		if( validRequests.empty() )
+			return;
+
+		network->EvaluateBatch( m_BatchInputs, m_BatchOutputs, m_BatchWorkspaces );
+
+		for( size_t i = 0 ; i < validRequests.size() ; ++i )
+		{
+			InferenceResult result;
+			result.Output.swap( m_BatchOutputs[i] );
+			validRequests[i]->Promise.set_value( std::move( result ) );
+		}
+
+		++m_NumBatches;
+		m_NumBatchedRequests += validRequests.size();
+	}
+
+	//===========================================================
+
+	InferenceClient::InferenceClient() :
+		m_Socket( InvalidSocket )
+	{
+	}
+
+	InferenceClient::~InferenceClient()
+	{
+		Disconnect();
+	}
+
+	bool InferenceClient::Connect( const char* _socketPath )
+	{
+		Disconnect();
+
+		sockaddr_un address;
+
+		if( !MakeAddress( _socketPath, address ) || !InitializeSockets() )
+			return false;
+
+		SOCKET clientSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+		if( (clientSocket == INVALID_SOCKET) || (connect( clientSocket, (const sockaddr*)&address, sizeof( address ) ) == SOCKET_ERROR) )
+		{
+			if( clientSocket != INVALID_SOCKET )
+				closesocket( clientSocket );
+
+			WSACleanup();
+			return false;
+		}
+
+		m_Socket = (uintptr_t)clientSocket;
+
+		return true;
+	}
+
+	void InferenceClient::Disconnect()
+	{
+		if( m_Socket == InvalidSocket )
+			return;
+
+		closesocket( (SOCKET)m_Socket );
+		m_Socket = InvalidSocket;
+
+		WSACleanup();
+	}
+
+	InferenceStatus InferenceClient::Evaluate( const Tensor& _in, Tensor& _out )
+	{
+		if( m_Socket == InvalidSocket )
+			return InferenceStatus::ConnectionError;
+
+		uint32_t numValues = (uint32_t)_in.size();
+		uint32_t header[2];
+
+		if( !SendAll( m_Socket, &numValues, sizeof( numValues ) ) ||
+			!SendAll( m_Socket, _in.data(), _in.size() * sizeof( Scalar ) ) ||
+			!ReceiveAll( m_Socket, header, sizeof( header ) ) ||
+			(header[1] > MaxRequestValues) )
+		{
+			Disconnect();
+			return InferenceStatus::ConnectionError;
+		}
+
+		_out.resize( header[1] );
+
+		if( !ReceiveAll( m_Socket, _out.data(), _out.size() * sizeof( Scalar ) ) )
+		{
+			Disconnect();
+			return InferenceStatus::ConnectionError;
+		}
+
+		return (InferenceStatus)header[0];
+	}
+
+	//===========================================================
+
+	LoadTestReport RunLoadTest( const char* _socketPath, const std::vector< Tensor >& _samples, uint32_t _numClients, uint32_t _numRequestsPerClient )
+	{
+		assert( !_samples.empty() );
+
+		typedef std::chrono::steady_clock Clock;
+
+		std::vector< std::vector< double > > latencies( _numClients ); //Milliseconds, per client
+		std::vector< uint32_t > numFailed( _numClients, 0 );
+		std::vector< std::thread > clients;
+
+		const Clock::time_point start = Clock::now();
+
+		for( uint32_t c = 0 ; c < _numClients ; ++c )
+		{
+			clients.push_back( std::thread( [&, c]()
+			{
+				InferenceClient client;
+
+				if( !client.Connect( _socketPath ) )
+				{
+					numFailed[c] = _numRequestsPerClient;
+					return;
+				}
+
+				latencies[c].reserve( _numRequestsPerClient );
+				Tensor out;
+
+				for( uint32_t r = 0 ; r < _numRequestsPerClient ; ++r )
+				{
+					const Tensor& sample = _samples[(c + r * _numClients) % _samples.size()];
+
+					Clock::time_point requestStart = Clock::now();
+					InferenceStatus status = client.Evaluate( sample, out );
+
+					if( status == InferenceStatus::Ok )
+						latencies[c].push_back( std::chrono::duration< double, std::milli >( Clock::now() - requestStart ).count() );
+					else
+						++numFailed[c];
+				}
+			} ) );
+		}
+
+		for( std::thread& client : clients )
+			client.join();
+
+		const double seconds = std::chrono::duration< double >( Clock::now() - start ).count();
+
+		std::vector< double > allLatencies;
+
+		for( const auto& clientLatencies : latencies )
+			allLatencies.insert( allLatencies.end(), clientLatencies.begin(), clientLatencies.end() );
+
+		std::sort( allLatencies.begin(), allLatencies.end() );
+
+		LoadTestReport report;
+		report.NumRequests = _numClients * _numRequestsPerClient;
+
+		for( uint32_t failed : numFailed )
+			report.NumFailedRequests += failed;
+
+		if( !allLatencies.empty() )
+		{
+			auto percentile = [&]( double _p ) { return allLatencies[std::min( allLatencies.size() - 1, (size_t)(_p * allLatencies.size()) )]; };
+
+			report.RequestsPerSecond = allLatencies.size() / seconds;
+			report.P50LatencyMilliseconds = percentile( 0.5 );
+			report.P99LatencyMilliseconds = percentile( 0.99 );
+		}
+
+		Log( "Load test: %d clients, %d requests (%d failed), %.0f requests/s, latency p50 %.3fms p99 %.3fms\n",
+			 _numClients, report.NumRequests, report.NumFailedRequests, report.RequestsPerSecond, report.P50LatencyMilliseconds, report.P99LatencyMilliseconds );
+
+		return report;
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "ModelRegistry.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <deque>
+#include <list>
+
+namespace ToyDNN
+{
+	//Local inference protocol, native endianness and Scalar type since both ends run on the same machine
+	//request:  uint32_t numValues, Scalar values[numValues]
+	//response: uint32_t status (InferenceStatus), uint32_t numValues, Scalar values[numValues]
+	enum class InferenceStatus : uint32_t
+	{
+		Ok,
+		InvalidInput,	//Size doesn't match the model input
+		Overloaded,		//Request queue is full, or the server isn't running
+		NoModel,		//Nothing published in the registry yet
+		ConnectionError //Client side only
+	};
+
+	struct InferenceResult
+	{
+		InferenceStatus Status = InferenceStatus::Ok;
+		Tensor Output;
+	};
+
+	//Serves the model published in a ModelRegistry on a Unix domain socket.
+	//Requests from all connections go to a bounded queue, a batching thread groups them in dynamic batches
+	//(up to MaxBatchSize requests, or whatever arrived MaxBatchDelay after the oldest one) evaluated with NeuralNetwork::EvaluateBatch().
+	struct InferenceServerSettings
+	{
+		uint32_t MaxBatchSize = 32;
+		uint32_t MaxBatchDelayMicroseconds = 2000;
+		uint32_t MaxQueuedRequests = 1024;
+	};
+
+	class InferenceServer
+	{
+	public:
+		InferenceServer( const ModelRegistry& _registry, const InferenceServerSettings& _settings = InferenceServerSettings() );
+		~InferenceServer();
+
+		InferenceServer( const InferenceServer& ) = delete;
+		InferenceServer& operator=( const InferenceServer& ) = delete;
+
+		bool Start( const char* _socketPath );
+		void Stop(); //Pending requests are completed, connections are closed
+
+		//In-process entry point, also used for requests received on the socket
+		std::future< InferenceResult > Submit( Tensor _input );
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Request
+		{
+			Tensor Input;
+			std::promise< InferenceResult > Promise;
+			Clock::time_point EnqueueTime;
+		};
+
+		struct Connection
+		{
+			uintptr_t Socket;
+			std::thread Thread;
+			bool Finished = false;
+		};
+
+		void AcceptLoop();
+		void ServeConnection( Connection* _connection );
+		void BatchLoop();
+		void RunBatch( std::vector< Request >& _batch );
+
+	private:
+		const ModelRegistry& m_Registry;
+		InferenceServerSettings m_Settings;
+
+		uintptr_t m_ListenSocket;
+		std::thread m_AcceptThread;
+
+		std::list< Connection > m_Connections;
+		std::mutex m_ConnectionsMutex;
+
+		std::deque< Request > m_Queue;
+		std::mutex m_QueueMutex;
+		std::condition_variable m_QueueCondition;
+		bool m_Stop = true; //Until Start() succeeds, requests are rejected as after Stop()
+		std::thread m_BatchThread;
+
+		//Batching thread only
+		std::vector< const Tensor* > m_BatchInputs;
+		std::vector< Tensor > m_BatchOutputs;
+		std::vector< EvaluationWorkspace > m_BatchWorkspaces;
+		uint64_t m_NumBatches = 0, m_NumBatchedRequests = 0;
+	};
+
+	//Blocking client of an InferenceServer, one request at a time
+	class InferenceClient
+	{
+	public:
+		InferenceClient();
+		~InferenceClient();
+
+		InferenceClient( const InferenceClient& ) = delete;
+		InferenceClient& operator=( const InferenceClient& ) = delete;
+
+		bool Connect( const char* _socketPath );
+		void Disconnect();
+
+		InferenceStatus Evaluate( const Tensor& _in, Tensor& _out );
+
+	private:
+		uintptr_t m_Socket;
+	};
+
+	struct LoadTestReport
+	{
+		uint32_t NumRequests = 0;
+		uint32_t NumFailedRequests = 0;
+		double RequestsPerSecond = 0.0;
+		double P50LatencyMilliseconds = 0.0;
+		double P99LatencyMilliseconds = 0.0;
+	};
+
+	//Load generator: _numClients connections each sending _numRequestsPerClient requests (cycling through _samples) back to back
+	LoadTestReport RunLoadTest( const char* _socketPath, const std::vector< Tensor >& _samples, uint32_t _numClients, uint32_t _numRequestsPerClient );
+}
@@ -42,7 +42,10 @@ namespace ToyDNN
 		Tanh,
 		SoftMax,
 
-		Padding
+		Padding,
+		Upsample2D,
+		DepthwiseConvolution2D,
+		PointwiseConvolution2D
 	};
 
 	class Layer
@@ -53,15 +56,39 @@ namespace ToyDNN
 
 		virtual LayerType GetType() const = 0;
 		virtual const char* GetName() const = 0;
+		//Padding read around the input, only materialized for networks compiled with pre-padded input.
+		//Otherwise layers handle it virtually and activations are stored unpadded.
 		virtual uint32_t GetInputPadding() const { return 0; }
 
 		virtual void Setup( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding ) = 0;
+		//Change the input size without touching trained parameters, to evaluate fully convolutional networks on other image sizes.
+		//Return false for layers that depend on the input size (FullyConnected, SoftMax)
+		virtual bool Reshape( const TensorShape& _inputShape ) { return false; }
+		//Output pixel (x, y) is aligned on input pixel (x * factorX, y * factorY)
+		virtual uint32_t GetDownsamplingFactorX() const { return 1; }
+		virtual uint32_t GetDownsamplingFactorY() const { return 1; }
 		virtual void Forward( const Tensor& _in, Tensor& _out ) const = 0;
+		virtual void TrainingForward( const Tensor& _in, Tensor& _out ) const { Forward( _in, _out ); } //Used while training, may record what BackPropagation() needs
+		//Forward() for layers needing temporary memory, taken from _scratch which is owned by the caller (see EvaluationWorkspace) and reused
+		//across layers and calls. Forward() allocates it on each call instead.
+		virtual void ForwardWithScratch( const Tensor& _in, Tensor& _out, Tensor& _scratch ) const { Forward( _in, _out ); }
+		//Incremental evaluation: output pixels depending on input pixels of _inputRegion. Layers that aren't spatially local return the whole output
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const { return Region::Whole( m_OutputShape ); }
+		//Only compute _outputRegion, the rest of _out still holds the output of a previous evaluation
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const { Forward( _in, _out ); }
+		virtual bool SupportsInPlace() const { return false; } //Forward() and BackPropagation() accept the same tensor for input and output
+		virtual bool BackPropagationNeedsInput() const { return true; } //Does BackPropagation() read _layerInputs
+		virtual bool BackPropagationNeedsOutput() const { return false; } //Does BackPropagation() read _layerOutputs
+		//Gradients and whatever back propagation needs, not allocated for inference only networks
+		virtual void AllocateTrainingResources() {}
+		virtual void ReleaseTrainingResources() {}
 		virtual void ClearGradients() {}
 		virtual void ScaleGradients( Scalar _scale ) {}
 		virtual void ApplyGradients( Optimizer& _optimizer ) {}
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _output, Tensor& _inputGradients ) = 0;
+		//_layerInputs and _layerOutputs are only valid when BackPropagationNeedsInput() and BackPropagationNeedsOutput() respectively
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) = 0;
 		virtual bool GetRandomParameterAndAssociatedGradient( Scalar** _parameter, Scalar& _gradient ) { return false; } //used for gradient checking
+		virtual void OnParametersModified() {} //A parameter was written through GetRandomParameterAndAssociatedGradient(), refresh what is derived from it
 		virtual void PrintStatistics() const {}
 		void PrintIOShape() const 
 		{
@@ -72,9 +99,6 @@ namespace ToyDNN
 
 		inline const TensorShape& GetInputShape() const { return m_InputShape; }
 		inline const TensorShape& GetOutputShape() const { return m_OutputShape; }
-		inline const Tensor& GetOutput() const { return m_Output; }
-
-		void CacheOutput( const Tensor& _output ) const { m_Output = _output; }
 
 		virtual void Load( std::istream& _stream ) 
 		{
@@ -90,14 +114,24 @@ namespace ToyDNN
 
 	protected:
 		TensorShape m_InputShape, m_OutputShape;
-
-	private:
-		mutable Tensor m_Output; //Only used during training for back propagation
 	};
 
 	class WeightsAndBiasesLayer : public Layer
 	{
 	public:
+		virtual void AllocateTrainingResources() override
+		{
+			m_WeightGradients.resize( m_Weights.size() );
+			m_BiasGradients.resize( m_Biases.size() );
+			ClearGradients();
+		}
+
+		virtual void ReleaseTrainingResources() override
+		{
+			std::vector<Scalar>().swap( m_WeightGradients );
+			std::vector<Scalar>().swap( m_BiasGradients );
+		}
+
 		virtual void ClearGradients() override
 		{
 			std::fill( m_WeightGradients.begin(), m_WeightGradients.end(), 0.0f );
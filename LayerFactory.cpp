@@ -1,9 +1,11 @@
 #include "pch.h"
 #include "Layers/FullyConnectedLayer.h"
 #include "Layers/Convolution2DLayer.h"
+#include "Layers/SeparableConvolution2DLayer.h"
 #include "Layers/MaxPoolingLayer.h"
 #include "Layers/Activation/ActivationLayers.h"
 #include "Layers/PaddingLayer.h"
+#include "Layers/Upsample2DLayer.h"
 
 namespace ToyDNN
 {
@@ -14,6 +16,8 @@ namespace ToyDNN
 			case LayerType::FullyConnected: return new FullyConnected;
 			case LayerType::Convolution2D: return new Convolution2D;
 			case LayerType::ConvolutionTranspose2D: return new ConvolutionTranspose2D;
+			case LayerType::DepthwiseConvolution2D: return new DepthwiseConvolution2D;
+			case LayerType::PointwiseConvolution2D: return new PointwiseConvolution2D;
 			case LayerType::MaxPooling: return new MaxPooling;
 				 
 			case LayerType::Relu: return new Relu;
@@ -22,6 +26,7 @@ namespace ToyDNN
 			case LayerType::Tanh: return new Tanh;
 //			case LayerType::SoftMax: return new SoftMax;
 			case LayerType::Padding: return new PaddingLayer;
+			case LayerType::Upsample2D: return new Upsample2D;
 			default: return nullptr;
 		}
 	}
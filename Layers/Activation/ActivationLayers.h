@@ -3,6 +3,7 @@
 // https://ml-cheatsheet.readthedocs.io/en/latest/activation_functions.html
 
 #include "Layer.h"
+#include "FastMath.h"
 #include <cmath>
 
 namespace ToyDNN
@@ -20,35 +21,97 @@ namespace ToyDNN
 			m_OutputShape.m_SY += _outputPadding - m_InputShape.m_Padding;
 			m_OutputShape.m_Padding = _outputPadding;
 		}
-	};
 
-	//====================================================
+		virtual bool Reshape( const TensorShape& _inputShape ) override
+		{
+			Setup( _inputShape, 0 );
+			return true;
+		}
 
-	class Relu : public BaseActivationLayer
-	{
-	public:
-		virtual LayerType GetType() const override { return LayerType::Relu; }
-		virtual const char* GetName() const override { return "Relu"; }
+		//Without padding on either side, input and output have the same layout and can be processed as flat arrays
+		inline bool IsElementWise() const { return (m_InputShape.m_Padding == 0) && (m_OutputShape.m_Padding == 0); }
 
-		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
+		virtual bool SupportsInPlace() const override { return IsElementWise(); }
+		virtual bool BackPropagationNeedsInput() const override { return false; }
+
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override
+		{
+			return IsElementWise() ? _inputRegion : Region::Whole( m_OutputShape );
+		}
+
+	protected:
+		//_out[i] = _function( _in[i] )
+		template< typename Function >
+		void ForwardElements( const Tensor& _in, Tensor& _out, Function _function ) const
 		{
+			if( IsElementWise() )
+			{
+				//Streaming loop the compiler can vectorize, _in and _out may be the same tensor
+				const Scalar* in = _in.data();
+				Scalar* out = _out.data();
+				const int n = (int)m_OutputShape.Size();
+
+				for( int i = 0 ; i < n ; ++i )
+					out[i] = _function( in[i] );
+
+				return;
+			}
+
 			if( m_OutputShape.m_Padding > 0 )
 				memset( &_out[0], 0, _out.size() * sizeof( Scalar ) );
 
-			for( uint32_t z = 0 ; z < m_InputShape.m_SZ; ++z )
+			for( uint32_t z = 0 ; z < m_InputShape.m_SZ ; ++z )
 			{
 				for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
 				{
 					for( uint32_t x = 0 ; x < m_InputShape.m_SX - m_InputShape.m_Padding ; ++x )
 					{
-						_out[m_OutputShape.PaddedIndex( x, y, z )] = std::max( _in[m_InputShape.Index( x, y, z )], Scalar( 0.0 ) );
+						_out[m_OutputShape.PaddedIndex( x, y, z )] = _function( _in[m_InputShape.Index( x, y, z )] );
 					}
 				}
 			}
 		}
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		//Same as ForwardElements(), restricted to _region
+		template< typename Function >
+		void ForwardRegionElements( const Tensor& _in, Tensor& _out, const Region& _region, Function _function ) const
 		{
+			if( !IsElementWise() )
+			{
+				ForwardElements( _in, _out, _function );
+				return;
+			}
+
+			for( uint32_t z = 0 ; z < m_OutputShape.m_SZ ; ++z )
+			{
+				for( uint32_t y = _region.Y0 ; y < _region.Y1 ; ++y )
+				{
+					const uint32_t rowIdx = m_OutputShape.Index( 0, y, z );
+
+					for( uint32_t x = _region.X0 ; x < _region.X1 ; ++x )
+						_out[rowIdx + x] = _function( _in[rowIdx + x] );
+				}
+			}
+		}
+
+		//_inputGradients[i] = _outputGradients[i] * _derivative( _layerOutputs[i] ), for activations whose derivative is a function of their output
+		template< typename Derivative >
+		void BackPropagateElements( const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients, Derivative _derivative ) const
+		{
+			if( IsElementWise() )
+			{
+				//_outputGradients and _inputGradients may be the same tensor
+				const Scalar* out = _layerOutputs.data();
+				const Scalar* outGradients = _outputGradients.data();
+				Scalar* inGradients = _inputGradients.data();
+				const int n = (int)m_OutputShape.Size();
+
+				for( int i = 0 ; i < n ; ++i )
+					inGradients[i] = outGradients[i] * _derivative( out[i] );
+
+				return;
+			}
+
 			for( uint32_t z = 0 ; z < m_InputShape.m_SZ ; ++z )
 			{
 				for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
@@ -58,9 +121,7 @@ namespace ToyDNN
 						uint32_t outIdx = m_OutputShape.PaddedIndex( x, y, z );
 						uint32_t inIdx = m_InputShape.Index( x, y, z );
 
-						Scalar gradient = _layerInputs[inIdx] >= Scalar( 0.0 ) ? Scalar( 1.0 ) : Scalar( 0.0 );
-
-						_inputGradients[inIdx] = _outputGradients[outIdx] * gradient;
+						_inputGradients[inIdx] = _outputGradients[outIdx] * _derivative( _layerOutputs[outIdx] );
 					}
 				}
 			}
@@ -69,19 +130,59 @@ namespace ToyDNN
 
 	//====================================================
 
-	class LeakyRelu : public BaseActivationLayer
+	//Relu family, the derivative only depends on the sign of the input.
+	//The training forward pass records it in a bit mask, so that back propagation needs neither the input nor the output.
+	class BaseRectifierLayer : public BaseActivationLayer
 	{
+	protected:
+		BaseRectifierLayer() {}
 	public:
-		LeakyRelu( Scalar _leak=0.01f) : m_Leak( _leak )
+		virtual void AllocateTrainingResources() override
 		{
-			assert( _leak > Scalar(0.0) );
+			m_SignMask.resize( (m_InputShape.Size() + 63) / 64 );
 		}
 
-		virtual LayerType GetType() const override { return LayerType::LeakyRelu; }
-		virtual const char* GetName() const override { return "LeakyRelu"; }
+		virtual void ReleaseTrainingResources() override
+		{
+			std::vector< uint64_t >().swap( m_SignMask );
+		}
 
-		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
+	protected:
+
+		//Same as ForwardElements(), bit i of the mask is set when _in[i] >= 0
+		template< typename Function >
+		void ForwardElementsAndRecordSigns( const Tensor& _in, Tensor& _out, Function _function ) const
 		{
+			const uint32_t n = m_InputShape.Size();
+			m_SignMask.resize( (n + 63) / 64 );
+
+			if( IsElementWise() )
+			{
+				const Scalar* in = _in.data();
+				Scalar* out = _out.data();
+				const int numWords = (int)m_SignMask.size();
+
+				for( int w = 0 ; w < numWords ; ++w )
+				{
+					const uint32_t first = w * 64;
+					const uint32_t count = std::min( 64u, n - first );
+					uint64_t signs = 0;
+
+					for( uint32_t b = 0 ; b < count ; ++b )
+					{
+						Scalar x = in[first + b];
+						signs |= uint64_t( x >= Scalar( 0.0 ) ) << b;
+						out[first + b] = _function( x );
+					}
+
+					m_SignMask[w] = signs;
+				}
+
+				return;
+			}
+
+			std::fill( m_SignMask.begin(), m_SignMask.end(), 0 );
+
 			if( m_OutputShape.m_Padding > 0 )
 				memset( &_out[0], 0, _out.size() * sizeof( Scalar ) );
 
@@ -91,17 +192,47 @@ namespace ToyDNN
 				{
 					for( uint32_t x = 0 ; x < m_InputShape.m_SX - m_InputShape.m_Padding ; ++x )
 					{
-						Scalar in = _in[m_InputShape.Index( x, y, z )];
+						uint32_t inIdx = m_InputShape.Index( x, y, z );
+						Scalar in = _in[inIdx];
 
-						_out[m_OutputShape.PaddedIndex( x, y, z )] = in > 0.0f ? in : in * m_Leak;
+						if( in >= Scalar( 0.0 ) )
+							m_SignMask[inIdx / 64] |= uint64_t( 1 ) << (inIdx % 64);
+
+						_out[m_OutputShape.PaddedIndex( x, y, z )] = _function( in );
 					}
 				}
 			}
-
 		}
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		//_inputGradients[i] = _outputGradients[i] * (input was >= 0 ? 1 : _negativeSlope)
+		void BackPropagateFromSigns( const Tensor& _outputGradients, Tensor& _inputGradients, Scalar _negativeSlope ) const
 		{
+			assert( m_SignMask.size() == (m_InputShape.Size() + 63) / 64 ); //TrainingForward() must have been called
+
+			if( IsElementWise() )
+			{
+				//_outputGradients and _inputGradients may be the same tensor
+				const Scalar* outGradients = _outputGradients.data();
+				Scalar* inGradients = _inputGradients.data();
+				const uint32_t n = m_InputShape.Size();
+				const int numWords = (int)m_SignMask.size();
+
+				for( int w = 0 ; w < numWords ; ++w )
+				{
+					const uint32_t first = w * 64;
+					const uint32_t count = std::min( 64u, n - first );
+					const uint64_t signs = m_SignMask[w];
+
+					for( uint32_t b = 0 ; b < count ; ++b )
+					{
+						Scalar gradient = ((signs >> b) & 1) ? Scalar( 1.0 ) : _negativeSlope;
+						inGradients[first + b] = outGradients[first + b] * gradient;
+					}
+				}
+
+				return;
+			}
+
 			for( uint32_t z = 0 ; z < m_InputShape.m_SZ ; ++z )
 			{
 				for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
@@ -111,13 +242,84 @@ namespace ToyDNN
 						uint32_t outIdx = m_OutputShape.PaddedIndex( x, y, z );
 						uint32_t inIdx = m_InputShape.Index( x, y, z );
 
-						Scalar gradient = _layerInputs[inIdx] >= Scalar( 0.0 ) ? Scalar( 1.0 ) : m_Leak;
+						Scalar gradient = ((m_SignMask[inIdx / 64] >> (inIdx % 64)) & 1) ? Scalar( 1.0 ) : _negativeSlope;
 
 						_inputGradients[inIdx] = _outputGradients[outIdx] * gradient;
 					}
 				}
 			}
+		}
 
+	private:
+		mutable std::vector< uint64_t > m_SignMask; //Only used during training for back propagation
+	};
+
+	//====================================================
+
+	class Relu : public BaseRectifierLayer
+	{
+	public:
+		virtual LayerType GetType() const override { return LayerType::Relu; }
+		virtual const char* GetName() const override { return "Relu"; }
+
+		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
+		{
+			ForwardElements( _in, _out, []( Scalar _x ) { return _x > Scalar( 0.0 ) ? _x : Scalar( 0.0 ); } );
+		}
+
+		virtual void TrainingForward( const Tensor& _in, Tensor& _out ) const override
+		{
+			ForwardElementsAndRecordSigns( _in, _out, []( Scalar _x ) { return _x > Scalar( 0.0 ) ? _x : Scalar( 0.0 ); } );
+		}
+
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
+		{
+			ForwardRegionElements( _in, _out, _outputRegion, []( Scalar _x ) { return _x > Scalar( 0.0 ) ? _x : Scalar( 0.0 ); } );
+		}
+
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		{
+			BackPropagateFromSigns( _outputGradients, _inputGradients, Scalar( 0.0 ) );
+		}
+	};
+
+	//====================================================
+
+	class LeakyRelu : public BaseRectifierLayer
+	{
+	public:
+		LeakyRelu( Scalar _leak=0.01f) : m_Leak( _leak )
+		{
+			assert( _leak > Scalar(0.0) );
+		}
+
+		virtual LayerType GetType() const override { return LayerType::LeakyRelu; }
+		virtual const char* GetName() const override { return "LeakyRelu"; }
+
+		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
+		{
+			const Scalar leak = m_Leak;
+
+			ForwardElements( _in, _out, [leak]( Scalar _x ) { return _x > Scalar( 0.0 ) ? _x : _x * leak; } );
+		}
+
+		virtual void TrainingForward( const Tensor& _in, Tensor& _out ) const override
+		{
+			const Scalar leak = m_Leak;
+
+			ForwardElementsAndRecordSigns( _in, _out, [leak]( Scalar _x ) { return _x > Scalar( 0.0 ) ? _x : _x * leak; } );
+		}
+
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
+		{
+			const Scalar leak = m_Leak;
+
+			ForwardRegionElements( _in, _out, _outputRegion, [leak]( Scalar _x ) { return _x > Scalar( 0.0 ) ? _x : _x * leak; } );
+		}
+
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		{
+			BackPropagateFromSigns( _outputGradients, _inputGradients, m_Leak );
 		}
 
 		virtual void Load( std::istream& _stream ) override
@@ -141,46 +343,21 @@ namespace ToyDNN
 	public:
 		virtual LayerType GetType() const override { return LayerType::Sigmoid; }
 		virtual const char* GetName() const override { return "Sigmoid"; }
+		virtual bool BackPropagationNeedsOutput() const override { return true; }
 
 		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
 		{
-			if( m_OutputShape.m_Padding > 0 )
-				memset( &_out[0], 0, _out.size() * sizeof( Scalar ) );
-
-			for( uint32_t z = 0 ; z < m_InputShape.m_SZ ; ++z )
-			{
-				for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
-				{
-					for( uint32_t x = 0 ; x < m_InputShape.m_SX - m_InputShape.m_Padding ; ++x )
-					{
-						Scalar in = _in[m_InputShape.Index( x, y, z )];
-
-						_out[m_OutputShape.PaddedIndex( x, y, z )] = Scalar( 1.0 ) / (Scalar( 1.0 ) + std::exp( -in ));
-					}
-				}
-			}
-
+			ForwardElements( _in, _out, []( Scalar _x ) { return Scalar( FastMath::Sigmoid( _x ) ); } );
 		}
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
 		{
-			for( uint32_t z = 0 ; z < m_InputShape.m_SZ ; ++z )
-			{
-				for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
-				{
-					for( uint32_t x = 0 ; x < m_InputShape.m_SX - m_InputShape.m_Padding ; ++x )
-					{
-						uint32_t outIdx = m_OutputShape.PaddedIndex( x, y, z );
-						uint32_t inIdx = m_InputShape.Index( x, y, z );
-						Scalar out = GetOutput()[outIdx];
-
-						Scalar gradient = out * (Scalar( 1.0 ) - out);
-
-						_inputGradients[inIdx] = _outputGradients[outIdx] * gradient;
-					}
-				}
-			}
+			ForwardRegionElements( _in, _out, _outputRegion, []( Scalar _x ) { return Scalar( FastMath::Sigmoid( _x ) ); } );
+		}
 
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		{
+			BackPropagateElements( _layerOutputs, _outputGradients, _inputGradients, []( Scalar _out ) { return _out * (Scalar( 1.0 ) - _out); } );
 		}
 	};
 
@@ -191,47 +368,23 @@ namespace ToyDNN
 	public:
 		virtual LayerType GetType() const override { return LayerType::Tanh; }
 		virtual const char* GetName() const override { return "Tanh"; }
+		virtual bool BackPropagationNeedsOutput() const override { return true; }
 
 		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
 		{
-			if( m_OutputShape.m_Padding > 0 )
-				memset( &_out[0], 0, _out.size() * sizeof( Scalar ) );
-
-			for( uint32_t z = 0 ; z < m_InputShape.m_SZ ; ++z )
-			{
-				for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
-				{
-					for( uint32_t x = 0 ; x < m_InputShape.m_SX - m_InputShape.m_Padding ; ++x )
-					{
-						Scalar in = _in[m_InputShape.Index( x, y, z )];
-
-						_out[m_OutputShape.PaddedIndex( x, y, z )] = std::tanh( in );
-					}
-				}
-			}
+			ForwardElements( _in, _out, []( Scalar _x ) { return Scalar( FastMath::Tanh( _x ) ); } );
 		}
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
 		{
-			for( uint32_t z = 0 ; z < m_InputShape.m_SZ ; ++z )
-			{
-				for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
-				{
-					for( uint32_t x = 0 ; x < m_InputShape.m_SX - m_InputShape.m_Padding ; ++x )
-					{
-						uint32_t outIdx = m_OutputShape.PaddedIndex( x, y, z );
-						uint32_t inIdx = m_InputShape.Index( x, y, z );
-						Scalar out = GetOutput()[outIdx];
-
-						//This one is a bit special
-						//dtanh(x)/dx = 1 - tanh(x)
-						Scalar gradient = Scalar( 1.0 ) - out * out;
-
-						_inputGradients[inIdx] = _outputGradients[outIdx] * gradient;
-					}
-				}
-			}
+			ForwardRegionElements( _in, _out, _outputRegion, []( Scalar _x ) { return Scalar( FastMath::Tanh( _x ) ); } );
+		}
 
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		{
+			//This one is a bit special
+			//dtanh(x)/dx = 1 - tanh(x)
+			BackPropagateElements( _layerOutputs, _outputGradients, _inputGradients, []( Scalar _out ) { return Scalar( 1.0 ) - _out * _out; } );
 		}
 	};
 
@@ -242,6 +395,9 @@ namespace ToyDNN
 
 		virtual LayerType GetType() const override { return LayerType::SoftMax; }
 		virtual const char* GetName() const override { return "SoftMax"; }
+		virtual bool BackPropagationNeedsOutput() const override { return true; }
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override { return Region::Whole( m_OutputShape ); } //Every output depends on every input
+		virtual bool Reshape( const TensorShape& _inputShape ) override { return false; }
 
 		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
 		{
@@ -266,7 +422,7 @@ namespace ToyDNN
 			}
 		}
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
 		{
 			assert( false );//TODO support padding
 			
@@ -280,7 +436,7 @@ namespace ToyDNN
 				for( uint32_t k=0; k < n ; ++k )
 				{
 					Scalar f = (k == j) ? Scalar(1.0) : Scalar(0.0);
-					df[k] = GetOutput()[j] * (f - GetOutput()[j]);
+					df[k] = _layerOutputs[j] * (f - _layerOutputs[j]);
 				}
 
 				for( uint32_t k = 0; k < n ; ++k )
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "Layer.h"
+#include "Upsample2DLayer.h"
+#include "Gemm.h"
+#include <omp.h>
 
 namespace ToyDNN
 {
@@ -10,13 +13,25 @@ namespace ToyDNN
 		Same
 	};
 
+	//Kernels a Convolution2D can run, picked from its shapes or measured (see ConvolutionTuner)
+	enum class ConvolutionAlgorithm : uint8_t
+	{
+		Direct, //Generic loops over the kernel taps
+		Gemm1x1, //1x1 kernel with stride 1: [F x C] weights times [C x H*W] input planes
+		Stride2Phases, //Stride 2: dense stride 1 convolution of the input split in even/odd phase planes
+		Im2ColGemm, //[F x CKK] weights times the [CKK x H*W] matrix of input patches. Forward only, back propagation runs the direct loops
+		Count
+	};
+
 	class Convolution2D : public WeightsAndBiasesLayer
 	{
 	public:
-		Convolution2D( uint32_t _numFeatureMaps=0, uint32_t _kernelSize=1, uint32_t _stride = 1, Padding _padding = Padding::Same )
-			: m_NumFeatureMaps( _numFeatureMaps ), m_KernelSize( _kernelSize ), m_Stride( _stride ), m_Padding( _padding )
+		//With _dilation > 1, kernel taps are _dilation pixels apart: a 3x3 kernel covers 5x5 pixels with a dilation of 2 for the cost of a 3x3 one
+		Convolution2D( uint32_t _numFeatureMaps=0, uint32_t _kernelSize=1, uint32_t _stride = 1, Padding _padding = Padding::Same, uint32_t _dilation = 1 )
+			: m_NumFeatureMaps( _numFeatureMaps ), m_KernelSize( _kernelSize ), m_Stride( _stride ), m_Padding( _padding ), m_Dilation( _dilation )
 		{
 			assert( m_KernelSize % 2 == 1 ); //TODO support even kernels ?
+			assert( m_Dilation > 0 );
 		}
 
 		virtual LayerType GetType() const override { return LayerType::Convolution2D; }
@@ -28,7 +43,7 @@ namespace ToyDNN
 
 			if( m_Padding == Padding::Same )
 			{
-				return m_KernelSize - m_Stride;
+				return GetKernelExtent() - m_Stride;
 			}
 			else
 			{
@@ -38,144 +53,806 @@ namespace ToyDNN
 
 		virtual void Setup( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding ) override
 		{
-			m_InputShape = _previousLayerOutputShape;
-			m_OutputShape = TensorShape( _outputPadding + (m_InputShape.m_SX - m_KernelSize + m_Stride ) / m_Stride,
-										 _outputPadding + (m_InputShape.m_SY - m_KernelSize + m_Stride ) / m_Stride,
-										 m_NumFeatureMaps,
-										 _outputPadding );
+			SetupShapes( _previousLayerOutputShape, _outputPadding );
 
 			m_KernelShape = TensorShape( m_KernelSize, m_KernelSize, m_InputShape.m_SZ );
 			m_Weights.resize( m_NumFeatureMaps * m_KernelShape.Size() );
-			m_WeightGradients.resize( m_Weights.size() );
-
 			m_Biases.resize( m_NumFeatureMaps );
-			m_BiasGradients.resize( m_NumFeatureMaps );
 
 			uint32_t fanIn = m_KernelSize * m_KernelSize * m_InputShape.m_SZ;
 			uint32_t fanOut = (m_KernelSize / m_Stride) * (m_KernelSize / m_Stride) * m_NumFeatureMaps;
 
 			WeightInit::He( fanIn, fanOut, m_Weights );
 			std::fill( m_Biases.begin(), m_Biases.end(), 0.0f );
+
+			PackWeights();
+		}
+
+		virtual bool Reshape( const TensorShape& _inputShape ) override
+		{
+			assert( _inputShape.m_SZ == m_KernelShape.m_SZ );
+
+			SetupShapes( _inputShape, 0 );
+
+			return true;
 		}
 
+		virtual uint32_t GetDownsamplingFactorX() const override { return m_Stride; }
+		virtual uint32_t GetDownsamplingFactorY() const override { return m_Stride; }
+
 		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
 		{
-			
-			Scalar* accum = (Scalar*)alloca( sizeof( Scalar ) * m_OutputShape.m_SZ );
+			Tensor scratch;
+			ForwardWithScratch( _in, _out, scratch );
+		}
+
+		virtual void ForwardWithScratch( const Tensor& _in, Tensor& _out, Tensor& _scratch ) const override
+		{
+			const uint32_t outSX = m_OutputShape.m_SX - m_OutputShape.m_Padding;
+			const uint32_t outSY = m_OutputShape.m_SY - m_OutputShape.m_Padding;
+
+			if( m_Algorithm == ConvolutionAlgorithm::Gemm1x1 )
+				ForwardGemm1x1( _in, _out );
+			else if( m_Algorithm == ConvolutionAlgorithm::Stride2Phases )
+				ForwardStride2Phases( _in, _out, _scratch );
+			else if( m_Algorithm == ConvolutionAlgorithm::Im2ColGemm )
+				ForwardIm2ColGemm( _in, _out, _scratch );
+			else
+				ForwardRegion( _in, _out, Region( 0, 0, outSX, outSY ) );
+		}
+
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override
+		{
+			assert( m_OutputShape.m_Padding == 0 );
 
-			for( uint32_t y = 0 ; y < m_OutputShape.m_SY - m_OutputShape.m_Padding ; ++y )
+			//Output x reads input [x * stride - haloLeft, x * stride - haloLeft + kernelExtent[
+			auto affectedRange = [&]( uint32_t _begin, uint32_t _end, uint32_t _outputSize, uint32_t& _outBegin, uint32_t& _outEnd )
 			{
-				for( uint32_t x = 0 ; x < m_OutputShape.m_SX - m_OutputShape.m_Padding ; ++x )
+				_outBegin = (_begin + m_HaloLeft + 1 > GetKernelExtent()) ? (_begin + m_HaloLeft + 1 - GetKernelExtent() + m_Stride - 1) / m_Stride : 0;
+				_outEnd = std::min( (_end - 1 + m_HaloLeft) / m_Stride + 1, _outputSize );
+			};
+
+			if( _inputRegion.IsEmpty() )
+				return Region();
+
+			Region outputRegion;
+			affectedRange( _inputRegion.X0, _inputRegion.X1, m_OutputShape.m_SX, outputRegion.X0, outputRegion.X1 );
+			affectedRange( _inputRegion.Y0, _inputRegion.Y1, m_OutputShape.m_SY, outputRegion.Y0, outputRegion.Y1 );
+
+			return outputRegion;
+		}
+
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
+		{
+			ForwardRegion( [&]( uint32_t _x, uint32_t _y, uint32_t _z ) { return _in[m_InputShape.Index( _x, _y, _z )]; }, _out, _outputRegion );
+		}
+
+		//Fused Upsample2D + Convolution2D: the upsampled input is read from _lowResIn on the fly instead of being stored
+		void ForwardUpsampled( const Tensor& _lowResIn, const Upsample2D& _upsample, Tensor& _out ) const
+		{
+			assert( (_upsample.GetOutputShape().m_SX == m_InputShape.m_SX) && (_upsample.GetOutputShape().m_SY == m_InputShape.m_SY) );
+			assert( (_upsample.GetOutputShape().m_SZ == m_InputShape.m_SZ) && (m_InputShape.m_Padding == 0) );
+
+			const uint32_t outSX = m_OutputShape.m_SX - m_OutputShape.m_Padding;
+			const uint32_t outSY = m_OutputShape.m_SY - m_OutputShape.m_Padding;
+
+			ForwardRegion( [&]( uint32_t _x, uint32_t _y, uint32_t _z ) { return _upsample.Sample( _lowResIn, _x, _y, _z ); }, _out, Region( 0, 0, outSX, outSY ) );
+		}
+
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		{
+			if( m_Algorithm == ConvolutionAlgorithm::Gemm1x1 )
+			{
+				BackPropagationGemm1x1( _layerInputs, _outputGradients, _inputGradients );
+				return;
+			}
+
+			if( m_Algorithm == ConvolutionAlgorithm::Stride2Phases )
+			{
+				BackPropagationStride2Phases( _layerInputs, _outputGradients, _inputGradients );
+				return;
+			}
+
+			const uint32_t outSX = m_OutputShape.m_SX - m_OutputShape.m_Padding;
+			const uint32_t outSY = m_OutputShape.m_SY - m_OutputShape.m_Padding;
+			const bool parallel = IsWorthParallelizing( GetNumMultiplyAdds( outSX * outSY ) );
+
+			//Weight and bias gradients: output rows are split in contiguous ranges, one per thread.
+			//Thread 0 accumulates into the layer gradients, the other ones into their own partials, which are then added in thread order
+			//so that results don't depend on scheduling.
+			const int maxThreads = parallel ? omp_get_max_threads() : 1;
+			const size_t partialSize = m_Weights.size() + m_Biases.size();
+
+			if( m_GradientPartials.size() < (maxThreads - 1) * partialSize )
+				m_GradientPartials.resize( (maxThreads - 1) * partialSize );
+
+			int numThreads = 1;
+
+			#pragma omp parallel num_threads( maxThreads ) if( parallel )
+			{
+				const int thread = omp_get_thread_num();
+				const int threadCount = omp_get_num_threads();
+
+				Scalar* weightGradients = m_WeightGradients.data();
+				Scalar* biasGradients = m_BiasGradients.data();
+
+				if( thread > 0 )
 				{
-					for( uint32_t f = 0 ; f < m_OutputShape.m_SZ ; ++f )
+					weightGradients = &m_GradientPartials[(thread - 1) * partialSize];
+					biasGradients = weightGradients + m_Weights.size();
+					std::fill( weightGradients, weightGradients + partialSize, Scalar( 0.0 ) );
+				}
+
+				if( thread == 0 )
+					numThreads = threadCount;
+
+				Scalar* dE_dN = (Scalar*)alloca( sizeof( Scalar ) * m_OutputShape.m_SZ );
+
+				for( uint32_t y = outSY * thread / threadCount ; y < outSY * (thread + 1) / threadCount ; ++y )
+				{
+					if( (y < m_InteriorY0) || (y >= m_InteriorY1) )
 					{
-						accum[f] = m_Biases[f];
+						AccumulateWeightGradients<true>( _layerInputs, _outputGradients, weightGradients, biasGradients, y, 0, outSX, dE_dN );
 					}
+					else
+					{
+						AccumulateWeightGradients<true>( _layerInputs, _outputGradients, weightGradients, biasGradients, y, 0, m_InteriorX0, dE_dN );
+						AccumulateWeightGradients<false>( _layerInputs, _outputGradients, weightGradients, biasGradients, y, m_InteriorX0, m_InteriorX1, dE_dN );
+						AccumulateWeightGradients<true>( _layerInputs, _outputGradients, weightGradients, biasGradients, y, m_InteriorX1, outSX, dE_dN );
+					}
+				}
+			}
 
-					for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+			for( int thread = 1 ; thread < numThreads ; ++thread )
+			{
+				const Scalar* partial = &m_GradientPartials[(thread - 1) * partialSize];
+
+				for( size_t i = 0 ; i < m_Weights.size() ; ++i )
+					m_WeightGradients[i] += partial[i];
+
+				for( size_t i = 0 ; i < m_Biases.size() ; ++i )
+					m_BiasGradients[i] += partial[m_Weights.size() + i];
+			}
+
+			//Input gradients are gathered from the output pixels reading each input pixel, input rows are independent
+			#pragma omp parallel if( parallel )
+			{
+				Scalar* dE_dI = (Scalar*)alloca( sizeof( Scalar ) * m_InputShape.m_SZ );
+
+				#pragma omp for schedule( static )
+				for( int sy = 0 ; sy < (int)m_InputShape.m_SY ; ++sy )
+				{
+					for( uint32_t sx = 0 ; sx < m_InputShape.m_SX ; ++sx )
+						GatherInputGradients( _outputGradients, _inputGradients, sx, sy, dE_dI );
+				}
+			}
+		}
+
+		virtual void ApplyGradients( Optimizer& _optimizer ) override
+		{
+			WeightsAndBiasesLayer::ApplyGradients( _optimizer );
+			PackWeights();
+		}
+
+		virtual void OnParametersModified() override
+		{
+			PackWeights();
+		}
+
+		virtual void ReleaseTrainingResources() override
+		{
+			WeightsAndBiasesLayer::ReleaseTrainingResources();
+			std::vector<Scalar>().swap( m_GradientPartials );
+			std::vector<Scalar>().swap( m_InputPhases );
+			std::vector<Scalar>().swap( m_PhaseGradients );
+		}
+
+		virtual void Load( std::istream& _stream ) override
+		{
+			WeightsAndBiasesLayer::Load( _stream );
+
+			Read( _stream, m_NumFeatureMaps );
+			Read( _stream, m_KernelSize );
+			Read( _stream, m_Stride );
+			Read( _stream, m_KernelShape );
+
+			m_Dilation = 1;
+
+			if( GetFileFormatVersion( _stream ) >= FileFormatVersion::Dilation )
+				Read( _stream, m_Dilation );
+
+			if( GetFileFormatVersion( _stream ) >= FileFormatVersion::Padding )
+			{
+				Read( _stream, m_Padding );
+			}
+			else
+			{
+				DeducePadding();
+			}
+
+			SetupHalo();
+			SetupInteriorRegion();
+			SetupAlgorithm();
+			PackWeights();
+		}
+
+		virtual void Save( std::ostream& _stream ) const override
+		{
+			WeightsAndBiasesLayer::Save( _stream );
+
+			Write( _stream, m_NumFeatureMaps );
+			Write( _stream, m_KernelSize );
+			Write( _stream, m_Stride );
+			Write( _stream, m_KernelShape );
+			Write( _stream, m_Dilation );
+			Write( _stream, m_Padding );
+		}
+
+		inline uint32_t GetKernelSize() const { return m_KernelSize; }
+		inline uint32_t GetStride() const { return m_Stride; }
+		inline uint32_t GetDilation() const { return m_Dilation; }
+		inline uint32_t GetKernelExtent() const { return (m_KernelSize - 1) * m_Dilation + 1; } //Width of the input window read by an output pixel
+		inline uint32_t GetNumFeatureMaps() const { return m_NumFeatureMaps; }
+		inline ConvolutionAlgorithm GetAlgorithm() const { return m_Algorithm; }
+		inline int GetNumThreads() const { return m_NumThreads; }
+
+		bool IsAlgorithmSupported( ConvolutionAlgorithm _algorithm ) const
+		{
+			switch( _algorithm )
+			{
+				case ConvolutionAlgorithm::Direct: return true;
+				//Without padding or stride, input and output channels are contiguous planes of the same size
+				case ConvolutionAlgorithm::Gemm1x1: return (m_KernelSize == 1) && (m_Stride == 1) && (m_InputShape.m_Padding == 0) && (m_OutputShape.m_Padding == 0);
+				case ConvolutionAlgorithm::Stride2Phases: return (m_KernelSize > 1) && (m_Stride == 2) && (m_OutputShape.m_Padding == 0);
+				case ConvolutionAlgorithm::Im2ColGemm: return m_OutputShape.m_Padding == 0;
+				default: return false;
+			}
+		}
+
+		//Override the algorithm picked from the shapes until the next Setup(), Reshape() or Load().
+		//_numThreads is used by the forward pass of layers large enough to be parallelized, 0 for all of them.
+		void SetAlgorithm( ConvolutionAlgorithm _algorithm, int _numThreads )
+		{
+			assert( IsAlgorithmSupported( _algorithm ) );
+
+			m_Algorithm = _algorithm;
+			m_NumThreads = _numThreads;
+		}
+
+	private:
+		void SetupShapes( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding )
+		{
+			m_InputShape = _previousLayerOutputShape;
+			SetupHalo();
+
+			m_OutputShape = TensorShape( _outputPadding + (m_InputShape.m_SX + m_Halo - GetKernelExtent() + m_Stride ) / m_Stride,
+										 _outputPadding + (m_InputShape.m_SY + m_Halo - GetKernelExtent() + m_Stride ) / m_Stride,
+										 m_NumFeatureMaps,
+										 _outputPadding );
+
+			SetupInteriorRegion();
+			SetupAlgorithm();
+		}
+
+		//m_Weights is [f][kz][ky][kx] (saved that way), the direct loops read the weights of all feature maps for one tap at a time:
+		//they get them from a [kz][ky][kx][f] copy, contiguous in f
+		void PackWeights()
+		{
+			m_PackedWeights.resize( m_Weights.size() );
+
+			for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+			{
+				for( uint32_t tap = 0 ; tap < m_KernelShape.Size() ; ++tap )
+					m_PackedWeights[tap * m_NumFeatureMaps + f] = m_Weights[m_KernelShape.Size() * f + tap];
+			}
+		}
+
+		void SetupAlgorithm()
+		{
+			if( IsAlgorithmSupported( ConvolutionAlgorithm::Gemm1x1 ) )
+				m_Algorithm = ConvolutionAlgorithm::Gemm1x1;
+			else if( IsAlgorithmSupported( ConvolutionAlgorithm::Stride2Phases ) )
+				m_Algorithm = ConvolutionAlgorithm::Stride2Phases;
+			else
+				m_Algorithm = ConvolutionAlgorithm::Direct;
+
+			m_NumThreads = 0;
+
+			//Phase planes (Stride2Phases) large enough for the taps of every output pixel and for every input pixel
+			m_PhaseSX = std::max( m_OutputShape.m_SX + (GetKernelExtent() - 1) / 2, (m_InputShape.m_SX + m_HaloLeft + 1) / 2 );
+			m_PhaseSY = std::max( m_OutputShape.m_SY + (GetKernelExtent() - 1) / 2, (m_InputShape.m_SY + m_HaloLeft + 1) / 2 );
+		}
+
+		//Files older than FileFormatVersion::Padding don't have the padding mode. Same padding shows as an output larger than
+		//the input allows without padding, but when the last window of a Same layer fits exactly both modes give the same size.
+		void DeducePadding()
+		{
+			uint32_t outSX = m_OutputShape.m_SX - m_OutputShape.m_Padding;
+			m_Padding = ((outSX - 1) * m_Stride + GetKernelExtent() > m_InputShape.m_SX) ? Padding::Same : Padding::Valid;
+
+			if( m_Padding == Padding::Valid )
+			{
+				//Same would only read the input at another offset
+				m_Padding = Padding::Same;
+				SetupHalo();
+				m_Padding = Padding::Valid;
+
+				uint32_t sameOutSX = (m_InputShape.m_SX + m_Halo - GetKernelExtent() + m_Stride) / m_Stride;
+
+				if( (m_HaloLeft > 0) && (sameOutSX == outSX) )
+					Log( "Convolution2D: padding mode of a file saved by an older version is ambiguous, Valid is assumed. Save it again once checked\n" );
+			}
+		}
+
+		//Padding which isn't materialized in the input tensor is virtual: out of bounds taps are skipped, as if they read zeroes.
+		//Like materialized padding, m_Halo / 2 is on the left/top side and the rest on the right/bottom side.
+		void SetupHalo()
+		{
+			uint32_t padding = GetInputPadding();
+			m_Halo = padding - std::min( padding, m_InputShape.m_Padding );
+			m_HaloLeft = m_Halo / 2;
+		}
+
+		//Range of output pixels whose receptive field doesn't overlap the virtual padding, no bound checks needed there
+		void SetupInteriorRegion()
+		{
+			auto interiorRange = [&]( uint32_t _inputSize, uint32_t _outputSize, uint32_t& _begin, uint32_t& _end )
+			{
+				//first x such as x * stride >= haloLeft, last x such as x * stride - haloLeft + kernelExtent <= inputSize
+				_begin = (m_HaloLeft + m_Stride - 1) / m_Stride;
+				_end = (_inputSize + m_HaloLeft >= GetKernelExtent()) ? (_inputSize + m_HaloLeft - GetKernelExtent()) / m_Stride + 1 : 0;
+
+				_end = std::min( _end, _outputSize );
+				_begin = std::min( _begin, _end );
+			};
+
+			interiorRange( m_InputShape.m_SX, m_OutputShape.m_SX - m_OutputShape.m_Padding, m_InteriorX0, m_InteriorX1 );
+			interiorRange( m_InputShape.m_SY, m_OutputShape.m_SY - m_OutputShape.m_Padding, m_InteriorY0, m_InteriorY1 );
+		}
+
+		//_read( x, y, z ) returns an input element
+		template< typename InputReader >
+		void ForwardRegion( const InputReader& _read, Tensor& _out, const Region& _outputRegion ) const
+		{
+			const uint32_t x0 = _outputRegion.X0;
+			const uint32_t x1 = std::max( _outputRegion.X1, x0 );
+			const uint32_t interiorX0 = std::min( std::max( m_InteriorX0, x0 ), x1 );
+			const uint32_t interiorX1 = std::min( std::max( m_InteriorX1, interiorX0 ), x1 );
+			const int y0 = (int)_outputRegion.Y0;
+			const int y1 = (int)_outputRegion.Y1;
+
+			//Output rows are independent
+			#pragma omp parallel num_threads( GetForwardThreadCount( (x1 - x0) * (y1 - std::min( y0, y1 )) ) )
+			{
+				Scalar* accum = (Scalar*)alloca( sizeof( Scalar ) * m_OutputShape.m_SZ );
+
+				#pragma omp for schedule( static )
+				for( int y = y0 ; y < y1 ; ++y )
+				{
+					if( (y < (int)m_InteriorY0) || (y >= (int)m_InteriorY1) )
 					{
-						for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+						ForwardPixels<true>( _read, _out, y, x0, x1, accum );
+					}
+					else
+					{
+						ForwardPixels<true>( _read, _out, y, x0, interiorX0, accum );
+						ForwardPixels<false>( _read, _out, y, interiorX0, interiorX1, accum );
+						ForwardPixels<true>( _read, _out, y, interiorX1, x1, accum );
+					}
+				}
+			}
+		}
+
+		template< bool CheckBounds, typename InputReader >
+		inline void ForwardPixels( const InputReader& _read, Tensor& _out, uint32_t _y, uint32_t _x0, uint32_t _x1, Scalar* _accum ) const
+		{
+			for( uint32_t x = _x0 ; x < _x1 ; ++x )
+			{
+				for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+				{
+					_accum[f] = m_Biases[f];
+				}
+
+				for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+				{
+					for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+					{
+						int sy = (int)(_y * m_Stride + ky * m_Dilation) - (int)m_HaloLeft;
+
+						if( CheckBounds && ((sy < 0) || (sy >= (int)m_InputShape.m_SY)) )
+							continue;
+
+						for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
 						{
-							uint32_t sy = y * m_Stride + ky;
+							int sx = (int)(x * m_Stride + kx * m_Dilation) - (int)m_HaloLeft;
 
-							for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
-							{
-								uint32_t sx = x * m_Stride + kx;
+							if( CheckBounds && ((sx < 0) || (sx >= (int)m_InputShape.m_SX)) )
+								continue;
 
-								for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
-								{
-									uint32_t inIdx = m_InputShape.Index( sx, sy, kz );
-									uint32_t weightIdx = m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, kz );
+							Scalar in = _read( sx, sy, kz );
+							const Scalar* weights = &m_PackedWeights[m_KernelShape.Index( kx, ky, kz ) * m_NumFeatureMaps];
 
-									accum[f] += _in[inIdx] * m_Weights[weightIdx];
-								}
+							for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+								_accum[f] += in * weights[f];
+						}
+					}
+				}
+
+				for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+				{
+					uint32_t outIdx = m_OutputShape.PaddedIndex( x, _y, f );
+
+					_out[outIdx] = _accum[f];
+				}
+			}
+		}
+
+		template< bool CheckBounds >
+		inline void AccumulateWeightGradients( const Tensor& _layerInputs, const Tensor& _outputGradients, Scalar* _weightGradients, Scalar* _biasGradients,
+											   uint32_t _y, uint32_t _x0, uint32_t _x1, Scalar* _dE_dN ) const
+		{
+			for( uint32_t x = _x0 ; x < _x1 ; ++x )
+			{
+				for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+				{
+					uint32_t outIdx = m_OutputShape.PaddedIndex( x, _y, f );
+					_dE_dN[f] = _outputGradients[outIdx];
+
+					_biasGradients[f] += _dE_dN[f]; //dN_dB is ignored because it is 1
+				}
+
+				for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+				{
+					for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+					{
+						int sy = (int)(_y * m_Stride + ky * m_Dilation) - (int)m_HaloLeft;
+
+						if( CheckBounds && ((sy < 0) || (sy >= (int)m_InputShape.m_SY)) )
+							continue;
+
+						for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
+						{
+							int sx = (int)(x * m_Stride + kx * m_Dilation) - (int)m_HaloLeft;
+
+							if( CheckBounds && ((sx < 0) || (sx >= (int)m_InputShape.m_SX)) )
+								continue;
+
+							Scalar dN_dW = _layerInputs[m_InputShape.Index( sx, sy, kz )];
+
+							for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+							{
+								uint32_t weightIdx = m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, kz );
+
+								_weightGradients[weightIdx] += _dE_dN[f] * dN_dW;
 							}
 						}
 					}
+				}
+			}
+		}
+
+		//dE/dI for all channels of input pixel (_sx, _sy): sum over the output pixels x such as x * stride - haloLeft + kx * dilation == _sx
+		inline void GatherInputGradients( const Tensor& _outputGradients, Tensor& _inputGradients, uint32_t _sx, uint32_t _sy, Scalar* _dE_dI ) const
+		{
+			const uint32_t outSX = m_OutputShape.m_SX - m_OutputShape.m_Padding;
+			const uint32_t outSY = m_OutputShape.m_SY - m_OutputShape.m_Padding;
+
+			for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+				_dE_dI[kz] = Scalar( 0.0 );
+
+			for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+			{
+				int oy = (int)(_sy + m_HaloLeft) - (int)(ky * m_Dilation);
+
+				if( (oy < 0) || (oy % m_Stride != 0) || (oy / m_Stride >= (int)outSY) )
+					continue;
+
+				const uint32_t y = oy / m_Stride;
+
+				for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
+				{
+					int ox = (int)(_sx + m_HaloLeft) - (int)(kx * m_Dilation);
+
+					if( (ox < 0) || (ox % m_Stride != 0) || (ox / m_Stride >= (int)outSX) )
+						continue;
+
+					const uint32_t x = ox / m_Stride;
 
 					for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
 					{
-						uint32_t outIdx = m_OutputShape.PaddedIndex( x, y, f );
+						const Scalar dE_dN = _outputGradients[m_OutputShape.PaddedIndex( x, y, f )];
+						const Scalar* weights = &m_Weights[m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, 0 )];
 
-						_out[outIdx] = accum[f];
+						for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+							_dE_dI[kz] += dE_dN * weights[kz * m_KernelSize * m_KernelSize];
 					}
 				}
 			}
+
+			for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+				_inputGradients[m_InputShape.Index( _sx, _sy, kz )] = _dE_dI[kz];
 		}
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		//Out[F x HW] = W[F x C] * In[C x HW] + biases
+		void ForwardGemm1x1( const Tensor& _in, Tensor& _out ) const
 		{
+			const uint32_t planeSize = m_InputShape.m_SX * m_InputShape.m_SY;
+
+			for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+				std::fill( &_out[f * planeSize], &_out[f * planeSize] + planeSize, m_Biases[f] );
+
+			Gemm( m_NumFeatureMaps, planeSize, m_InputShape.m_SZ, { m_Weights.data(), m_InputShape.m_SZ, false }, { _in.data(), planeSize, false }, _out.data(), planeSize, m_NumThreads );
+		}
+
+		//dE/dW[F x C] += dE/dN[F x HW] * In^T[HW x C], dE/dI[C x HW] = W^T[C x F] * dE/dN[F x HW]
+		void BackPropagationGemm1x1( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients )
+		{
+			const uint32_t numChannels = m_InputShape.m_SZ;
+			const uint32_t planeSize = m_InputShape.m_SX * m_InputShape.m_SY;
+
+			for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+			{
+				const Scalar* dE_dN = &_outputGradients[f * planeSize];
+
+				Scalar biasGradient = 0.0;
+
+				for( uint32_t i = 0 ; i < planeSize ; ++i )
+					biasGradient += dE_dN[i];
+
+				m_BiasGradients[f] += biasGradient;
+			}
+
+			Gemm( m_NumFeatureMaps, numChannels, planeSize, { _outputGradients.data(), planeSize, false }, { _layerInputs.data(), planeSize, true }, m_WeightGradients.data(), numChannels );
+
 			std::fill( _inputGradients.begin(), _inputGradients.end(), Scalar( 0.0 ) );
+			Gemm( numChannels, planeSize, m_NumFeatureMaps, { m_Weights.data(), numChannels, true }, { _outputGradients.data(), planeSize, false }, _inputGradients.data(), planeSize );
+		}
 
-			Scalar* dE_dN = (Scalar*)alloca( sizeof( Scalar ) * m_OutputShape.m_SZ );
+		//Stride 2: phase (px, py) of channel c holds the input pixels (2u + px - haloLeft, 2v + py - haloLeft), zero out of the input.
+		//Tap (kx, ky) at offset (tx, ty) = (kx, ky) * dilation of output pixel (x, y) then reads pixel (x + tx / 2, y + ty / 2) of phase (tx % 2, ty % 2), so the inner loops run
+		//along contiguous rows like a stride 1 convolution instead of touching every other element.
+		inline uint32_t GetPhaseOffset( uint32_t _px, uint32_t _py, uint32_t _c ) const
+		{
+			return (_c * 4 + _py * 2 + _px) * m_PhaseSX * m_PhaseSY;
+		}
 
-			for( uint32_t y = 0 ; y < m_OutputShape.m_SY - m_OutputShape.m_Padding ; ++y )
+		void SplitPhases( const Tensor& _in, Tensor& _phases ) const
+		{
+			_phases.resize( m_InputShape.m_SZ * 4 * m_PhaseSX * m_PhaseSY );
+
+			for( uint32_t c = 0 ; c < m_InputShape.m_SZ ; ++c )
 			{
-				for( uint32_t x = 0 ; x < m_OutputShape.m_SX - m_OutputShape.m_Padding ; ++x )
+				for( uint32_t py = 0 ; py < 2 ; ++py )
 				{
-					for( uint32_t f = 0 ; f < m_OutputShape.m_SZ ; ++f )
+					for( uint32_t px = 0 ; px < 2 ; ++px )
 					{
-						uint32_t outIdx = m_OutputShape.PaddedIndex( x, y, f );
-						dE_dN[f] = _outputGradients[outIdx];
+						Scalar* phase = &_phases[GetPhaseOffset( px, py, c )];
+
+						for( uint32_t v = 0 ; v < m_PhaseSY ; ++v )
+						{
+							Scalar* row = phase + v * m_PhaseSX;
+							int sy = (int)(v * 2 + py) - (int)m_HaloLeft;
 
-						m_BiasGradients[f] += dE_dN[f]; //dN_dB is ignored because it is 1
+							for( uint32_t u = 0 ; u < m_PhaseSX ; ++u )
+							{
+								int sx = (int)(u * 2 + px) - (int)m_HaloLeft;
+								bool inside = (sx >= 0) && (sx < (int)m_InputShape.m_SX) && (sy >= 0) && (sy < (int)m_InputShape.m_SY);
+
+								row[u] = inside ? _in[m_InputShape.Index( sx, sy, c )] : Scalar( 0.0 );
+							}
+						}
 					}
+				}
+			}
+		}
+
+		//Taps are accumulated in the same order as ForwardPixels(), results are identical. The phase planes are written to _scratch.
+		void ForwardStride2Phases( const Tensor& _in, Tensor& _out, Tensor& _scratch ) const
+		{
+			SplitPhases( _in, _scratch );
+
+			const Tensor& phases = _scratch;
+
+			#pragma omp parallel for num_threads( GetForwardThreadCount( m_OutputShape.m_SX * m_OutputShape.m_SY ) )
+			for( int f = 0 ; f < (int)m_NumFeatureMaps ; ++f )
+			{
+				const Scalar* weights = &m_Weights[m_KernelShape.Size() * f];
+
+				for( uint32_t y = 0 ; y < m_OutputShape.m_SY ; ++y )
+				{
+					Scalar* outRow = &_out[m_OutputShape.Index( 0, y, f )];
+
+					for( uint32_t x = 0 ; x < m_OutputShape.m_SX ; ++x )
+						outRow[x] = m_Biases[f];
 
 					for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
 					{
 						for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
 						{
-							uint32_t sy = y * m_Stride + ky;
-
 							for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
 							{
-								uint32_t sx = x * m_Stride + kx;
+								const uint32_t tx = kx * m_Dilation, ty = ky * m_Dilation;
+								const Scalar w = weights[m_KernelShape.Index( kx, ky, kz )];
+								const Scalar* in = &phases[GetPhaseOffset( tx % 2, ty % 2, kz ) + (y + ty / 2) * m_PhaseSX + tx / 2];
 
-								for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
-								{
-									uint32_t inIdx = m_InputShape.Index( sx, sy, kz );
-									uint32_t weightIdx = m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, kz );
+								for( uint32_t x = 0 ; x < m_OutputShape.m_SX ; ++x )
+									outRow[x] += w * in[x];
+							}
+						}
+					}
+				}
+			}
+		}
 
-									Scalar dN_dW = _layerInputs[inIdx];
-									m_WeightGradients[weightIdx] += dE_dN[f] * dN_dW;
+		void BackPropagationStride2Phases( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients )
+		{
+			const bool parallel = IsWorthParallelizing( GetNumMultiplyAdds( m_OutputShape.m_SX * m_OutputShape.m_SY ) );
 
-									_inputGradients[inIdx] += dE_dN[f] * m_Weights[weightIdx];
-								}
+			SplitPhases( _layerInputs, m_InputPhases );
+
+			//Each feature map owns its weight and bias gradients
+			#pragma omp parallel for if( parallel )
+			for( int f = 0 ; f < (int)m_NumFeatureMaps ; ++f )
+			{
+				const Scalar* dE_dN = &_outputGradients[m_OutputShape.Index( 0, 0, f )];
+				Scalar* weightGradients = &m_WeightGradients[m_KernelShape.Size() * f];
+
+				Scalar biasGradient = 0.0;
+
+				for( uint32_t i = 0 ; i < m_OutputShape.m_SX * m_OutputShape.m_SY ; ++i )
+					biasGradient += dE_dN[i];
+
+				m_BiasGradients[f] += biasGradient;
+
+				for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+				{
+					for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+					{
+						for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
+						{
+							const uint32_t tx = kx * m_Dilation, ty = ky * m_Dilation;
+							const Scalar* in = &m_InputPhases[GetPhaseOffset( tx % 2, ty % 2, kz ) + (ty / 2) * m_PhaseSX + tx / 2];
+
+							Scalar weightGradient = 0.0;
+
+							for( uint32_t y = 0 ; y < m_OutputShape.m_SY ; ++y )
+							{
+								for( uint32_t x = 0 ; x < m_OutputShape.m_SX ; ++x )
+									weightGradient += dE_dN[y * m_OutputShape.m_SX + x] * in[y * m_PhaseSX + x];
 							}
+
+							weightGradients[m_KernelShape.Index( kx, ky, kz )] += weightGradient;
 						}
 					}
 				}
 			}
 
+			//Input gradients are scattered into the phases of their channel, each channel owns its phases
+			m_PhaseGradients.assign( m_InputPhases.size(), Scalar( 0.0 ) );
+
+			#pragma omp parallel for if( parallel )
+			for( int kz = 0 ; kz < (int)m_InputShape.m_SZ ; ++kz )
+			{
+				for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+				{
+					const Scalar* dE_dN = &_outputGradients[m_OutputShape.Index( 0, 0, f )];
+
+					for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+					{
+						for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
+						{
+							const uint32_t tx = kx * m_Dilation, ty = ky * m_Dilation;
+							const Scalar w = m_Weights[m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, kz )];
+							Scalar* dE_dI = &m_PhaseGradients[GetPhaseOffset( tx % 2, ty % 2, kz ) + (ty / 2) * m_PhaseSX + tx / 2];
+
+							for( uint32_t y = 0 ; y < m_OutputShape.m_SY ; ++y )
+							{
+								for( uint32_t x = 0 ; x < m_OutputShape.m_SX ; ++x )
+									dE_dI[y * m_PhaseSX + x] += w * dE_dN[y * m_OutputShape.m_SX + x];
+							}
+						}
+					}
+				}
+			}
+
+			//Interleave the phases back, the ones of the virtual padding are dropped
+			for( uint32_t c = 0 ; c < m_InputShape.m_SZ ; ++c )
+			{
+				for( uint32_t sy = 0 ; sy < m_InputShape.m_SY ; ++sy )
+				{
+					const uint32_t py = (sy + m_HaloLeft) % 2, v = (sy + m_HaloLeft) / 2;
+
+					for( uint32_t sx = 0 ; sx < m_InputShape.m_SX ; ++sx )
+					{
+						const uint32_t px = (sx + m_HaloLeft) % 2, u = (sx + m_HaloLeft) / 2;
+
+						_inputGradients[m_InputShape.Index( sx, sy, c )] = m_PhaseGradients[GetPhaseOffset( px, py, c ) + v * m_PhaseSX + u];
+					}
+				}
+			}
 		}
 
-		virtual void Load( std::istream& _stream ) override
+		//Row (kz, ky, kx) of the patch matrix holds, for every output pixel, the input pixel read by that tap (zero in the virtual padding).
+		//The matrix is built and multiplied by blocks of c_GemmBlockN output pixels, one GEMM panel: each thread only needs
+		//[C*K*K x c_GemmBlockN] scalars of _scratch whatever the size of the image.
+		void ForwardIm2ColGemm( const Tensor& _in, Tensor& _out, Tensor& _scratch ) const
 		{
-			WeightsAndBiasesLayer::Load( _stream );
+			const uint32_t planeSize = m_OutputShape.m_SX * m_OutputShape.m_SY;
+			const uint32_t patchSize = m_KernelShape.Size();
+			const int numBlocks = (int)((planeSize + c_GemmBlockN - 1) / c_GemmBlockN);
+			const int numThreads = std::min( GetForwardThreadCount( planeSize ), numBlocks );
 
-			Read( _stream, m_NumFeatureMaps );
-			Read( _stream, m_KernelSize );
-			Read( _stream, m_Stride );
-			Read( _stream, m_KernelShape );
+			_scratch.resize( (size_t)numThreads * patchSize * c_GemmBlockN );
+
+			for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+				std::fill( &_out[f * planeSize], &_out[f * planeSize] + planeSize, m_Biases[f] );
+
+			#pragma omp parallel for schedule( static ) num_threads( numThreads )
+			for( int block = 0 ; block < numBlocks ; ++block )
+			{
+				const uint32_t pixel0 = block * c_GemmBlockN;
+				const uint32_t numPixels = std::min( c_GemmBlockN, planeSize - pixel0 );
+				Scalar* patches = &_scratch[(size_t)omp_get_thread_num() * patchSize * c_GemmBlockN];
+
+				for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+				{
+					for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+					{
+						for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
+						{
+							Scalar* row = &patches[m_KernelShape.Index( kx, ky, kz ) * numPixels];
+							uint32_t x = pixel0 % m_OutputShape.m_SX, y = pixel0 / m_OutputShape.m_SX;
+
+							for( uint32_t p = 0 ; p < numPixels ; ++p )
+							{
+								int sx = (int)(x * m_Stride + kx * m_Dilation) - (int)m_HaloLeft;
+								int sy = (int)(y * m_Stride + ky * m_Dilation) - (int)m_HaloLeft;
+								bool inside = (sx >= 0) && (sx < (int)m_InputShape.m_SX) && (sy >= 0) && (sy < (int)m_InputShape.m_SY);
+
+								row[p] = inside ? _in[m_InputShape.Index( sx, sy, kz )] : Scalar( 0.0 );
+
+								if( ++x == m_OutputShape.m_SX )
+								{
+									x = 0;
+									++y;
+								}
+							}
+						}
+					}
+				}
+
+				Gemm( m_NumFeatureMaps, numPixels, patchSize, { m_Weights.data(), patchSize, false }, { patches, numPixels, false }, &_out[pixel0], planeSize, 1 );
+			}
 		}
 
-		virtual void Save( std::ostream& _stream ) const override
+		//Cost of _numOutputPixels pixels of every feature map, what IsWorthParallelizing() is given
+		inline size_t GetNumMultiplyAdds( uint32_t _numOutputPixels ) const
 		{
-			WeightsAndBiasesLayer::Save( _stream );
-
-			Write( _stream, m_NumFeatureMaps );
-			Write( _stream, m_KernelSize );
-			Write( _stream, m_Stride );
-			Write( _stream, m_KernelShape );
+			return (size_t)_numOutputPixels * m_NumFeatureMaps * m_KernelShape.Size();
 		}
 
-		inline uint32_t GetKernelSize() const { return m_KernelSize; }
-		inline uint32_t GetNumFeatureMaps() const { return m_NumFeatureMaps; }
+		inline int GetForwardThreadCount( uint32_t _numOutputPixels ) const
+		{
+			if( !IsWorthParallelizing( GetNumMultiplyAdds( _numOutputPixels ) ) )
+				return 1;
+
+			return m_NumThreads > 0 ? m_NumThreads : omp_get_max_threads();
+		}
 
 	private:
 		uint32_t m_NumFeatureMaps, m_KernelSize, m_Stride;
 		Padding m_Padding;
+		uint32_t m_Dilation;
+		ConvolutionAlgorithm m_Algorithm = ConvolutionAlgorithm::Direct;
+		int m_NumThreads = 0; //Of the forward pass, 0 for all of them
 		TensorShape m_KernelShape;
+
+		uint32_t m_Halo = 0, m_HaloLeft = 0; //Virtual padding
+		uint32_t m_InteriorX0 = 0, m_InteriorX1 = 0, m_InteriorY0 = 0, m_InteriorY1 = 0;
+		std::vector< Scalar > m_PackedWeights; //See PackWeights()
+		std::vector< Scalar > m_GradientPartials; //Weight and bias gradients of threads other than the first one
+		uint32_t m_PhaseSX = 0, m_PhaseSY = 0; //Size of a phase plane (Stride2Phases)
+		std::vector< Scalar > m_InputPhases, m_PhaseGradients; //Back propagation of Stride2Phases
 	};
 
 
@@ -195,31 +872,13 @@ namespace ToyDNN
 
 		virtual void Setup( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding ) override
 		{
-			uint32_t padding;
-
-			if( m_Padding == Padding::Same )
-			{
-				padding = m_KernelSize - m_Stride;
-			}
-			else
-			{
-				assert( false ); //codepath untested
-				padding = 0;
-			}
+			assert( _outputPadding == 0 );
 
-
-			m_InputShape = _previousLayerOutputShape;
-			m_OutputShape = TensorShape( (m_InputShape.m_SX - m_InputShape.m_Padding - 1) * m_Stride + m_KernelSize,
-										 (m_InputShape.m_SY - m_InputShape.m_Padding - 1) * m_Stride + m_KernelSize,
-										 m_NumFeatureMaps,
-										 std::max( padding, _outputPadding ) );
+			SetupShapes( _previousLayerOutputShape );
 
 			m_KernelShape = TensorShape( m_KernelSize, m_KernelSize, m_InputShape.m_SZ );
 			m_Weights.resize( m_NumFeatureMaps * m_KernelShape.Size() );
-			m_WeightGradients.resize( m_Weights.size() );
-
 			m_Biases.resize( m_NumFeatureMaps );
-			m_BiasGradients.resize( m_NumFeatureMaps );
 
 			//TODO probably incorrect
 			uint32_t fanIn = m_KernelSize * m_KernelSize * m_InputShape.m_SZ;
@@ -229,81 +888,184 @@ namespace ToyDNN
 			std::fill( m_Biases.begin(), m_Biases.end(), 0.0f );
 		}
 
+		virtual bool Reshape( const TensorShape& _inputShape ) override
+		{
+			assert( _inputShape.m_SZ == m_KernelShape.m_SZ );
+
+			SetupShapes( _inputShape );
+
+			return true;
+		}
+
+		//Input x is scattered to outputs [x * stride, x * stride + kernelSize[
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override
+		{
+			if( _inputRegion.IsEmpty() )
+				return Region();
+
+			return Region( _inputRegion.X0 * m_Stride, _inputRegion.Y0 * m_Stride,
+						   std::min( (_inputRegion.X1 - 1) * m_Stride + m_KernelSize, m_OutputShape.m_SX ),
+						   std::min( (_inputRegion.Y1 - 1) * m_Stride + m_KernelSize, m_OutputShape.m_SY ) );
+		}
+
 		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
 		{
-			std::fill( _out.begin(), _out.end(), Scalar( 0.0 ) );//TODO memset ?
+			ForwardRegion( _in, _out, Region::Whole( m_OutputShape ) );
+		}
+
+		//Output stationary: each output pixel gathers the input pixels x such as x * stride + kx == outputX
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
+		{
+			const uint32_t inSX = m_InputShape.m_SX - m_InputShape.m_Padding;
+			const uint32_t inSY = m_InputShape.m_SY - m_InputShape.m_Padding;
+			const int y0 = (int)_outputRegion.Y0;
+			const int y1 = (int)_outputRegion.Y1;
 
-			for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
+			#pragma omp parallel if( IsWorthParallelizing( GetNumMultiplyAdds( (_outputRegion.X1 - std::min( _outputRegion.X0, _outputRegion.X1 )) * (y1 - std::min( y0, y1 )) ) ) )
 			{
-				for( uint32_t x = 0 ; x < m_InputShape.m_SX - m_InputShape.m_Padding ; ++x )
-				{					
-					for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
+				Scalar* accum = (Scalar*)alloca( sizeof( Scalar ) * m_NumFeatureMaps );
+
+				#pragma omp for schedule( static )
+				for( int y = y0 ; y < y1 ; ++y )
+				{
+					for( uint32_t x = _outputRegion.X0 ; x < _outputRegion.X1 ; ++x )
 					{
-						uint32_t inIdx = m_InputShape.PaddedIndex( x, y, kz );
-						Scalar in = _in[inIdx];
+						for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+							accum[f] = m_Biases[f];
 
 						for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
 						{
-							uint32_t sy = y * m_Stride + ky;
+							uint32_t iy;
+
+							if( !GetInputCoordinate( y, ky, inSY, iy ) )
+								continue;
 
 							for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
 							{
-								uint32_t sx = x * m_Stride + kx;
+								uint32_t ix;
 
-								for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+								if( !GetInputCoordinate( x, kx, inSX, ix ) )
+									continue;
+
+								for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
 								{
-									uint32_t outIdx = m_OutputShape.Index( sx, sy, f );
-									uint32_t weightIdx = m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, kz );
-									_out[outIdx] += m_Biases[f] + m_Weights[weightIdx] * in;
-									//TODO test average instead of add to avoid checkerboard artefacts
+									Scalar in = _in[m_InputShape.PaddedIndex( ix, iy, kz )];
+
+									for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+										accum[f] += in * m_Weights[m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, kz )];
 								}
 							}
 						}
+
+						for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+							_out[m_OutputShape.Index( x, y, f )] = accum[f];
 					}
 				}
 			}
 		}
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
 		{
+			const uint32_t inSX = m_InputShape.m_SX - m_InputShape.m_Padding;
+			const uint32_t inSY = m_InputShape.m_SY - m_InputShape.m_Padding;
+			const bool parallel = IsWorthParallelizing( GetNumMultiplyAdds( m_OutputShape.m_SX * m_OutputShape.m_SY ) );
+
+			//Bias gradients, dN_dB is 1 for every output
+			for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+			{
+				for( uint32_t y = 0 ; y < m_OutputShape.m_SY ; ++y )
+				{
+					for( uint32_t x = 0 ; x < m_OutputShape.m_SX ; ++x )
+						m_BiasGradients[f] += _outputGradients[m_OutputShape.Index( x, y, f )];
+				}
+			}
+
 			std::fill( _inputGradients.begin(), _inputGradients.end(), Scalar( 0.0 ) );
 
-			Scalar* dE_dN = (Scalar*)alloca( sizeof( Scalar ) * m_OutputShape.m_SZ );
-			memset( dE_dN, 0, sizeof( Scalar ) * m_OutputShape.m_SZ );
+			//Input stationary: input pixel x receives the gradients of outputs [x * stride, x * stride + kernelSize[.
+			//Input rows are split in contiguous ranges, one per thread, so input gradients are written by a single thread.
+			//Thread 0 accumulates into the layer weight gradients, the other ones into partials added in thread order.
+			const int maxThreads = parallel ? omp_get_max_threads() : 1;
+
+			if( m_GradientPartials.size() < (maxThreads - 1) * m_Weights.size() )
+				m_GradientPartials.resize( (maxThreads - 1) * m_Weights.size() );
+
+			int numThreads = 1;
 
-			for( uint32_t y = 0 ; y < m_InputShape.m_SY - m_InputShape.m_Padding ; ++y )
+			#pragma omp parallel num_threads( maxThreads ) if( parallel )
 			{
-				for( uint32_t x = 0 ; x < m_InputShape.m_SX - m_InputShape.m_Padding ; ++x )
+				const int thread = omp_get_thread_num();
+				const int threadCount = omp_get_num_threads();
+
+				Scalar* weightGradients = m_WeightGradients.data();
+
+				if( thread > 0 )
 				{
-					for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
-					{
-						uint32_t inIdx = m_InputShape.PaddedIndex( x, y, kz );
-						Scalar in = _layerInputs[inIdx];
+					weightGradients = &m_GradientPartials[(thread - 1) * m_Weights.size()];
+					std::fill( weightGradients, weightGradients + m_Weights.size(), Scalar( 0.0 ) );
+				}
+
+				if( thread == 0 )
+					numThreads = threadCount;
+
+				Scalar* dE_dN = (Scalar*)alloca( sizeof( Scalar ) * m_NumFeatureMaps );
 
+				for( uint32_t iy = inSY * thread / threadCount ; iy < inSY * (thread + 1) / threadCount ; ++iy )
+				{
+					for( uint32_t ix = 0 ; ix < inSX ; ++ix )
+					{
 						for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
 						{
-							uint32_t sy = y * m_Stride + ky;
+							const uint32_t y = iy * m_Stride + ky;
+
+							if( y >= m_OutputShape.m_SY )
+								break; //Cropped
 
 							for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
 							{
-								uint32_t sx = x * m_Stride + kx;
+								const uint32_t x = ix * m_Stride + kx;
+
+								if( x >= m_OutputShape.m_SX )
+									break; //Cropped
 
 								for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+									dE_dN[f] = _outputGradients[m_OutputShape.Index( x, y, f )];
+
+								for( uint32_t kz = 0 ; kz < m_InputShape.m_SZ ; ++kz )
 								{
-									uint32_t outIdx = m_OutputShape.Index( sx, sy, f );
-									uint32_t weightIdx = m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, kz );
-									
-									dE_dN[f] += _outputGradients[outIdx];
-
-									m_BiasGradients[f] += dE_dN[f];
-									Scalar dN_dW = in;
-									m_WeightGradients[weightIdx] += dE_dN[f] * dN_dW;
+									const uint32_t inIdx = m_InputShape.PaddedIndex( ix, iy, kz );
+									const Scalar dN_dW = _layerInputs[inIdx];
+									Scalar dE_dI = Scalar( 0.0 );
+
+									for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+									{
+										const uint32_t weightIdx = m_KernelShape.Size() * f + m_KernelShape.Index( kx, ky, kz );
+
+										weightGradients[weightIdx] += dE_dN[f] * dN_dW;
+										dE_dI += dE_dN[f] * m_Weights[weightIdx];
+									}
+
+									_inputGradients[inIdx] += dE_dI;
 								}
 							}
 						}
 					}
 				}
 			}
+
+			for( int thread = 1 ; thread < numThreads ; ++thread )
+			{
+				const Scalar* partial = &m_GradientPartials[(thread - 1) * m_Weights.size()];
+
+				for( size_t i = 0 ; i < m_Weights.size() ; ++i )
+					m_WeightGradients[i] += partial[i];
+			}
+		}
+
+		virtual void ReleaseTrainingResources() override
+		{
+			WeightsAndBiasesLayer::ReleaseTrainingResources();
+			std::vector<Scalar>().swap( m_GradientPartials );
 		}
 
 		virtual void Load( std::istream& _stream ) override
@@ -329,10 +1091,50 @@ namespace ToyDNN
 		inline uint32_t GetKernelSize() const { return m_KernelSize; }
 		inline uint32_t GetNumFeatureMaps() const { return m_NumFeatureMaps; }
 
+	private:
+		void SetupShapes( const TensorShape& _previousLayerOutputShape )
+		{
+			uint32_t padding;
+
+			if( m_Padding == Padding::Same )
+			{
+				padding = m_KernelSize - m_Stride;
+			}
+			else
+			{
+				assert( false ); //codepath untested
+				padding = 0;
+			}
+
+			//The full transposed convolution is cropped by "padding" on the right/bottom side, cropped outputs are not stored
+			m_InputShape = _previousLayerOutputShape;
+			m_OutputShape = TensorShape( (m_InputShape.m_SX - m_InputShape.m_Padding - 1) * m_Stride + m_KernelSize - padding,
+										 (m_InputShape.m_SY - m_InputShape.m_Padding - 1) * m_Stride + m_KernelSize - padding,
+										 m_NumFeatureMaps );
+		}
+
+		//Input coordinate scattered to _outputCoord by kernel tap _k, if any
+		inline bool GetInputCoordinate( uint32_t _outputCoord, uint32_t _k, uint32_t _inputSize, uint32_t& _inputCoord ) const
+		{
+			if( (_outputCoord < _k) || ((_outputCoord - _k) % m_Stride != 0) )
+				return false;
+
+			_inputCoord = (_outputCoord - _k) / m_Stride;
+
+			return _inputCoord < _inputSize;
+		}
+
+		//Cost of _numOutputPixels pixels of every feature map, what IsWorthParallelizing() is given
+		inline size_t GetNumMultiplyAdds( uint32_t _numOutputPixels ) const
+		{
+			return (size_t)_numOutputPixels * m_NumFeatureMaps * m_KernelShape.Size();
+		}
+
 	private:
 		uint32_t m_NumFeatureMaps, m_KernelSize, m_Stride;
 		Padding m_Padding;
 		TensorShape m_KernelShape;
+		std::vector< Scalar > m_GradientPartials; //Weight gradients of threads other than the first one
 	};
 
 }
\ No newline at end of file
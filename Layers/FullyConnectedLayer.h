@@ -29,10 +29,7 @@ namespace ToyDNN
 			uint32_t outputSize = m_OutputShape.SizeWithoutPadding();
 
 			m_Weights.resize( inputSize * outputSize );
-			m_WeightGradients.resize( m_Weights.size() );
-
 			m_Biases.resize( outputSize );
-			m_BiasGradients.resize( outputSize );
 
 			//WeightInit::Xavier( m_InputShape.Size(), m_OutputShape.Size(), m_Weights );
 			WeightInit::He( inputSize, outputSize, m_Weights );
@@ -61,7 +58,7 @@ namespace ToyDNN
 			}
 		}
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
 		{
 			uint32_t inputSize = m_InputShape.Size();
 			uint32_t outputSize = m_OutputShape.Size();
@@ -16,6 +16,7 @@ namespace ToyDNN
 
 		virtual LayerType GetType() const override { return LayerType::MaxPooling; }
 		virtual const char* GetName() const override { return "MaxPooling"; }
+		virtual bool BackPropagationNeedsInput() const override { return false; }
 
 		virtual void Setup( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding ) override
 		{
@@ -24,55 +25,54 @@ namespace ToyDNN
 			m_OutputShape = TensorShape( (_previousLayerOutputShape.m_SX + m_PoolSizeX  - 1) / m_PoolSizeX, 
 										 (_previousLayerOutputShape.m_SY + m_PoolSizeY  - 1) / m_PoolSizeY, 
 										 _previousLayerOutputShape.m_SZ );
+		}
+
+		virtual bool Reshape( const TensorShape& _inputShape ) override
+		{
+			Setup( _inputShape, 0 );
+			return true;
+		}
+
+		virtual uint32_t GetDownsamplingFactorX() const override { return m_PoolSizeX; }
+		virtual uint32_t GetDownsamplingFactorY() const override { return m_PoolSizeY; }
 
+		virtual void AllocateTrainingResources() override
+		{
 			m_MaxElement.resize( m_OutputShape.Size() );
 		}
 
+		virtual void ReleaseTrainingResources() override
+		{
+			std::vector<PixelCoord>().swap( m_MaxElement );
+		}
+
 		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
 		{
-			//#pragma omp parallel for
-			for( int z = 0 ; z < (int)m_OutputShape.m_SZ ; ++z )
-			{
-				for( int y = 0 ; y < (int)m_OutputShape.m_SY ; ++y )
-				{
-					for( int x = 0 ; x < (int)m_OutputShape.m_SX ; ++x )
-					{
-						uint32_t outIdx = m_OutputShape.Index( x, y, z );
-						
-						Scalar maxValue = sizeof(Scalar) == sizeof(double) ? -DBL_MAX : -FLT_MAX;
-						PixelCoord maxElemCoord = { 0,0 };
+			Pool< false >( _in, _out, Region::Whole( m_OutputShape ) );
+		}
 
-						uint32_t poolSizeY = std::min( m_PoolSizeY, m_InputShape.m_SY - y * m_PoolSizeY );
+		virtual void TrainingForward( const Tensor& _in, Tensor& _out ) const override
+		{
+			assert( m_MaxElement.size() == m_OutputShape.Size() ); //AllocateTrainingResources() must have been called
 
-						for( uint32_t py = 0 ; py < poolSizeY ; ++py )
-						{
-							uint32_t poolSizeX = std::min( m_PoolSizeX, m_InputShape.m_SX - x * m_PoolSizeX );
+			Pool< true >( _in, _out, Region::Whole( m_OutputShape ) );
+		}
 
-							for( uint32_t px = 0 ; px < poolSizeX ; ++px )
-							{
-								uint32_t inIdx = m_InputShape.Index( x * m_PoolSizeX + px, y * m_PoolSizeY + py, z );
-								Scalar v = _in[inIdx];
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override
+		{
+			if( _inputRegion.IsEmpty() )
+				return Region();
 
-								//TODO if( IsTraining )
-								if( v > maxValue )
-								{
-									maxValue = v;
-									maxElemCoord.x = px;
-									maxElemCoord.y = py;
-								}
-								//else maxValue = std::max( maxValue, v );
-							}
-						}
+			return Region( _inputRegion.X0 / m_PoolSizeX, _inputRegion.Y0 / m_PoolSizeY,
+						   (_inputRegion.X1 - 1) / m_PoolSizeX + 1, (_inputRegion.Y1 - 1) / m_PoolSizeY + 1 );
+		}
 
-						_out[outIdx] = maxValue;
-						m_MaxElement[outIdx] = maxElemCoord;
-					}
-				}
-			}
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
+		{
+			Pool< false >( _in, _out, _outputRegion );
 		}
 
-		
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
 		{
 			std::fill( _inputGradients.begin(), _inputGradients.end(), Scalar( 0.0 ) );
 				
@@ -105,7 +105,6 @@ namespace ToyDNN
 			Read( _stream, m_PoolSizeX );
 			Read( _stream, m_PoolSizeY );
 
-			m_MaxElement.resize( m_OutputShape.Size() ); //TODO don't do this if only inferring
 		}
 
 		virtual void Save( std::ostream& _stream ) const override
@@ -116,6 +115,52 @@ namespace ToyDNN
 			Write( _stream, m_PoolSizeY );
 		}
 
+	private:
+		//Only the training forward pass records the position of the max element, inference doesn't write to the layer
+		template< bool RecordMaxElement >
+		void Pool( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const
+		{
+			//#pragma omp parallel for
+			for( int z = 0 ; z < (int)m_OutputShape.m_SZ ; ++z )
+			{
+				for( int y = (int)_outputRegion.Y0 ; y < (int)_outputRegion.Y1 ; ++y )
+				{
+					for( int x = (int)_outputRegion.X0 ; x < (int)_outputRegion.X1 ; ++x )
+					{
+						uint32_t outIdx = m_OutputShape.Index( x, y, z );
+						
+						Scalar maxValue = sizeof(Scalar) == sizeof(double) ? -DBL_MAX : -FLT_MAX;
+						PixelCoord maxElemCoord = { 0,0 };
+
+						uint32_t poolSizeY = std::min( m_PoolSizeY, m_InputShape.m_SY - y * m_PoolSizeY );
+
+						for( uint32_t py = 0 ; py < poolSizeY ; ++py )
+						{
+							uint32_t poolSizeX = std::min( m_PoolSizeX, m_InputShape.m_SX - x * m_PoolSizeX );
+
+							for( uint32_t px = 0 ; px < poolSizeX ; ++px )
+							{
+								uint32_t inIdx = m_InputShape.Index( x * m_PoolSizeX + px, y * m_PoolSizeY + py, z );
+								Scalar v = _in[inIdx];
+
+								if( v > maxValue )
+								{
+									maxValue = v;
+									maxElemCoord.x = px;
+									maxElemCoord.y = py;
+								}
+							}
+						}
+
+						_out[outIdx] = maxValue;
+
+						if( RecordMaxElement )
+							m_MaxElement[outIdx] = maxElemCoord;
+					}
+				}
+			}
+		}
+
 	private:
 		uint32_t m_PoolSizeX, m_PoolSizeY;
 
@@ -22,6 +22,7 @@ namespace ToyDNN
 	public:
 		virtual LayerType GetType() const override { return LayerType::Padding; }
 		virtual const char* GetName() const override { return "Padding"; }
+		virtual bool BackPropagationNeedsInput() const override { return false; }
 
 		virtual void Setup( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding ) override
 		{
@@ -33,6 +34,18 @@ namespace ToyDNN
 			m_OutputShape.m_SY += m_Padding;
 		}
 
+		virtual bool Reshape( const TensorShape& _inputShape ) override
+		{
+			Setup( _inputShape, m_Padding );
+			return true;
+		}
+
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override
+		{
+			const uint32_t offset = m_Padding / 2;
+			return Region( _inputRegion.X0 + offset, _inputRegion.Y0 + offset, _inputRegion.X1 + offset, _inputRegion.Y1 + offset );
+		}
+
 		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
 		{
 			memset( &_out[0], 0, _out.size() * sizeof( Scalar ) );
@@ -50,7 +63,7 @@ namespace ToyDNN
 		}
 
 
-		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
 		{
 		}
 
@@ -0,0 +1,377 @@
+#pragma once
+
+#include "Layer.h"
+#include "Convolution2DLayer.h"
+
+namespace ToyDNN
+{
+	//Depthwise separable convolution = DepthwiseConvolution2D (spatial filtering of each channel on its own) + PointwiseConvolution2D (channel mixing).
+	//A KxK convolution from C to F channels costs K*K*C*F multiply-adds per pixel, the separable pair K*K*C + C*F.
+	//Tensors store channels as contiguous planes, the inner loops of both layers run along rows or planes with unit stride so that they vectorize.
+	//PointwiseConvolution2D is a matrix product, see Gemm().
+
+	class DepthwiseConvolution2D : public WeightsAndBiasesLayer
+	{
+	public:
+		DepthwiseConvolution2D( uint32_t _kernelSize=3, uint32_t _stride = 1, Padding _padding = Padding::Same )
+			: m_KernelSize( _kernelSize ), m_Stride( _stride ), m_Padding( _padding )
+		{
+			assert( m_KernelSize % 2 == 1 );
+		}
+
+		virtual LayerType GetType() const override { return LayerType::DepthwiseConvolution2D; }
+		virtual const char* GetName() const override { return "DepthwiseConvolution2D"; }
+
+		virtual uint32_t GetInputPadding() const override
+		{
+			return m_Padding == Padding::Same ? m_KernelSize - m_Stride : 0;
+		}
+
+		virtual void Setup( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding ) override
+		{
+			assert( _outputPadding == 0 );
+
+			SetupShapes( _previousLayerOutputShape );
+
+			m_KernelShape = TensorShape( m_KernelSize, m_KernelSize, m_InputShape.m_SZ );
+			m_Weights.resize( m_KernelShape.Size() );
+			m_Biases.resize( m_InputShape.m_SZ );
+
+			uint32_t fanIn = m_KernelSize * m_KernelSize;
+			uint32_t fanOut = (m_KernelSize / m_Stride) * (m_KernelSize / m_Stride);
+
+			WeightInit::He( fanIn, fanOut, m_Weights );
+			std::fill( m_Biases.begin(), m_Biases.end(), 0.0f );
+		}
+
+		virtual bool Reshape( const TensorShape& _inputShape ) override
+		{
+			assert( _inputShape.m_SZ == m_KernelShape.m_SZ );
+
+			SetupShapes( _inputShape );
+
+			return true;
+		}
+
+		virtual uint32_t GetDownsamplingFactorX() const override { return m_Stride; }
+		virtual uint32_t GetDownsamplingFactorY() const override { return m_Stride; }
+
+		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
+		{
+			ForwardRegion( _in, _out, Region::Whole( m_OutputShape ) );
+		}
+
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override
+		{
+			//Same receptive fields as Convolution2D
+			auto affectedRange = [&]( uint32_t _begin, uint32_t _end, uint32_t _outputSize, uint32_t& _outBegin, uint32_t& _outEnd )
+			{
+				_outBegin = (_begin + m_HaloLeft + 1 > m_KernelSize) ? (_begin + m_HaloLeft + 1 - m_KernelSize + m_Stride - 1) / m_Stride : 0;
+				_outEnd = std::min( (_end - 1 + m_HaloLeft) / m_Stride + 1, _outputSize );
+			};
+
+			if( _inputRegion.IsEmpty() )
+				return Region();
+
+			Region outputRegion;
+			affectedRange( _inputRegion.X0, _inputRegion.X1, m_OutputShape.m_SX, outputRegion.X0, outputRegion.X1 );
+			affectedRange( _inputRegion.Y0, _inputRegion.Y1, m_OutputShape.m_SY, outputRegion.Y0, outputRegion.Y1 );
+
+			return outputRegion;
+		}
+
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
+		{
+			const uint32_t x0 = _outputRegion.X0;
+			const uint32_t x1 = std::max( _outputRegion.X1, x0 );
+
+			//Channels are independent
+			#pragma omp parallel for if( IsWorthParallelizing( GetNumMultiplyAdds( (x1 - x0) * (_outputRegion.Y1 - std::min( _outputRegion.Y0, _outputRegion.Y1 )) ) ) )
+			for( int z = 0 ; z < (int)m_OutputShape.m_SZ ; ++z )
+			{
+				const Scalar* inPlane = &_in[m_InputShape.Index( 0, 0, z )];
+				const Scalar* weights = &m_Weights[m_KernelShape.Index( 0, 0, z )];
+
+				for( uint32_t y = _outputRegion.Y0 ; y < _outputRegion.Y1 ; ++y )
+				{
+					Scalar* outRow = &_out[m_OutputShape.Index( 0, y, z )];
+
+					for( uint32_t x = x0 ; x < x1 ; ++x )
+						outRow[x] = m_Biases[z];
+
+					for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+					{
+						int sy = (int)(y * m_Stride + ky) - (int)m_HaloLeft;
+
+						if( (sy < 0) || (sy >= (int)m_InputShape.m_SY) )
+							continue;
+
+						const Scalar* inRow = inPlane + sy * m_InputShape.m_SX;
+
+						for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
+						{
+							const Scalar w = weights[ky * m_KernelSize + kx];
+
+							uint32_t tapX0, tapX1;
+							GetTapRange( kx, x0, x1, tapX0, tapX1 );
+
+							for( uint32_t x = tapX0 ; x < tapX1 ; ++x )
+								outRow[x] += w * inRow[x * m_Stride + kx - m_HaloLeft];
+						}
+					}
+				}
+			}
+		}
+
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		{
+			//Each channel only touches its own weights, bias and input plane: no partial gradients are needed
+			#pragma omp parallel for if( IsWorthParallelizing( GetNumMultiplyAdds( m_OutputShape.m_SX * m_OutputShape.m_SY ) ) )
+			for( int z = 0 ; z < (int)m_OutputShape.m_SZ ; ++z )
+			{
+				const Scalar* inPlane = &_layerInputs[m_InputShape.Index( 0, 0, z )];
+				Scalar* inGradientPlane = &_inputGradients[m_InputShape.Index( 0, 0, z )];
+				const Scalar* outGradientPlane = &_outputGradients[m_OutputShape.Index( 0, 0, z )];
+				const Scalar* weights = &m_Weights[m_KernelShape.Index( 0, 0, z )];
+				Scalar* weightGradients = &m_WeightGradients[m_KernelShape.Index( 0, 0, z )];
+
+				std::fill( inGradientPlane, inGradientPlane + m_InputShape.m_SX * m_InputShape.m_SY, Scalar( 0.0 ) );
+
+				Scalar biasGradient = 0.0;
+
+				for( uint32_t i = 0 ; i < m_OutputShape.m_SX * m_OutputShape.m_SY ; ++i )
+					biasGradient += outGradientPlane[i]; //dN_dB is ignored because it is 1
+
+				m_BiasGradients[z] += biasGradient;
+
+				for( uint32_t y = 0 ; y < m_OutputShape.m_SY ; ++y )
+				{
+					const Scalar* dE_dN = outGradientPlane + y * m_OutputShape.m_SX;
+
+					for( uint32_t ky = 0 ; ky < m_KernelSize ; ++ky )
+					{
+						int sy = (int)(y * m_Stride + ky) - (int)m_HaloLeft;
+
+						if( (sy < 0) || (sy >= (int)m_InputShape.m_SY) )
+							continue;
+
+						const Scalar* inRow = inPlane + sy * m_InputShape.m_SX;
+						Scalar* inGradientRow = inGradientPlane + sy * m_InputShape.m_SX;
+
+						for( uint32_t kx = 0 ; kx < m_KernelSize ; ++kx )
+						{
+							const Scalar w = weights[ky * m_KernelSize + kx];
+
+							uint32_t tapX0, tapX1;
+							GetTapRange( kx, 0, m_OutputShape.m_SX, tapX0, tapX1 );
+
+							Scalar weightGradient = 0.0;
+
+							for( uint32_t x = tapX0 ; x < tapX1 ; ++x )
+							{
+								weightGradient += dE_dN[x] * inRow[x * m_Stride + kx - m_HaloLeft];
+								inGradientRow[x * m_Stride + kx - m_HaloLeft] += dE_dN[x] * w;
+							}
+
+							weightGradients[ky * m_KernelSize + kx] += weightGradient;
+						}
+					}
+				}
+			}
+		}
+
+		virtual void Load( std::istream& _stream ) override
+		{
+			WeightsAndBiasesLayer::Load( _stream );
+
+			Read( _stream, m_KernelSize );
+			Read( _stream, m_Stride );
+			Read( _stream, m_Padding );
+			Read( _stream, m_KernelShape );
+
+			SetupHalo();
+		}
+
+		virtual void Save( std::ostream& _stream ) const override
+		{
+			WeightsAndBiasesLayer::Save( _stream );
+
+			Write( _stream, m_KernelSize );
+			Write( _stream, m_Stride );
+			Write( _stream, m_Padding );
+			Write( _stream, m_KernelShape );
+		}
+
+		inline uint32_t GetKernelSize() const { return m_KernelSize; }
+
+	private:
+		void SetupShapes( const TensorShape& _previousLayerOutputShape )
+		{
+			m_InputShape = _previousLayerOutputShape;
+			SetupHalo();
+
+			m_OutputShape = TensorShape( (m_InputShape.m_SX + m_Halo - m_KernelSize + m_Stride) / m_Stride,
+										 (m_InputShape.m_SY + m_Halo - m_KernelSize + m_Stride) / m_Stride,
+										 m_InputShape.m_SZ );
+		}
+
+		//Virtual padding, see Convolution2D::SetupHalo()
+		void SetupHalo()
+		{
+			uint32_t padding = GetInputPadding();
+			m_Halo = padding - std::min( padding, m_InputShape.m_Padding );
+			m_HaloLeft = m_Halo / 2;
+		}
+
+		//Output columns [_tapX0, _tapX1[ of [_x0, _x1[ whose tap _kx reads inside the input row, the inner loops then don't check bounds
+		inline void GetTapRange( uint32_t _kx, uint32_t _x0, uint32_t _x1, uint32_t& _tapX0, uint32_t& _tapX1 ) const
+		{
+			const uint32_t begin = (_kx >= m_HaloLeft) ? 0 : (m_HaloLeft - _kx + m_Stride - 1) / m_Stride;
+			const uint32_t end = (m_InputShape.m_SX + m_HaloLeft > _kx) ? (m_InputShape.m_SX + m_HaloLeft - _kx - 1) / m_Stride + 1 : 0;
+
+			_tapX0 = std::max( begin, _x0 );
+			_tapX1 = std::min( end, _x1 );
+		}
+
+		//Cost of _numOutputPixels pixels of every channel, what IsWorthParallelizing() is given
+		inline size_t GetNumMultiplyAdds( uint32_t _numOutputPixels ) const
+		{
+			return (size_t)_numOutputPixels * m_KernelShape.Size();
+		}
+
+	private:
+		uint32_t m_KernelSize, m_Stride;
+		Padding m_Padding;
+		TensorShape m_KernelShape; //One KxK kernel per channel
+		uint32_t m_Halo = 0, m_HaloLeft = 0;
+	};
+
+	//1x1 convolution: every output plane is a weighted sum of the input planes
+	class PointwiseConvolution2D : public WeightsAndBiasesLayer
+	{
+	public:
+		PointwiseConvolution2D( uint32_t _numFeatureMaps=0 )
+			: m_NumFeatureMaps( _numFeatureMaps )
+		{
+		}
+
+		virtual LayerType GetType() const override { return LayerType::PointwiseConvolution2D; }
+		virtual const char* GetName() const override { return "PointwiseConvolution2D"; }
+
+		virtual void Setup( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding ) override
+		{
+			assert( _outputPadding == 0 );
+			assert( _previousLayerOutputShape.m_Padding == 0 );
+
+			m_InputShape = _previousLayerOutputShape;
+			m_OutputShape = TensorShape( m_InputShape.m_SX, m_InputShape.m_SY, m_NumFeatureMaps );
+
+			m_Weights.resize( m_NumFeatureMaps * m_InputShape.m_SZ );
+			m_Biases.resize( m_NumFeatureMaps );
+
+			WeightInit::He( m_InputShape.m_SZ, m_NumFeatureMaps, m_Weights );
+			std::fill( m_Biases.begin(), m_Biases.end(), 0.0f );
+		}
+
+		virtual bool Reshape( const TensorShape& _inputShape ) override
+		{
+			assert( _inputShape.m_SZ * m_NumFeatureMaps == m_Weights.size() );
+
+			m_InputShape = _inputShape;
+			m_OutputShape = TensorShape( m_InputShape.m_SX, m_InputShape.m_SY, m_NumFeatureMaps );
+
+			return true;
+		}
+
+		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
+		{
+			const uint32_t planeSize = m_InputShape.m_SX * m_InputShape.m_SY;
+
+			//Out[F x HW] = W[F x C] * In[C x HW] + biases
+			for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+				std::fill( &_out[f * planeSize], &_out[f * planeSize] + planeSize, m_Biases[f] );
+
+			Gemm( m_NumFeatureMaps, planeSize, m_InputShape.m_SZ, { m_Weights.data(), m_InputShape.m_SZ, false }, { _in.data(), planeSize, false }, _out.data(), planeSize );
+		}
+
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override
+		{
+			return _inputRegion;
+		}
+
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
+		{
+			for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+			{
+				for( uint32_t y = _outputRegion.Y0 ; y < _outputRegion.Y1 ; ++y )
+					MixChannels( _in, _out, f, y * m_InputShape.m_SX + _outputRegion.X0, _outputRegion.X1 - _outputRegion.X0 );
+			}
+		}
+
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		{
+			const uint32_t numChannels = m_InputShape.m_SZ;
+			const uint32_t planeSize = m_InputShape.m_SX * m_InputShape.m_SY;
+
+			for( uint32_t f = 0 ; f < m_NumFeatureMaps ; ++f )
+			{
+				const Scalar* dE_dN = &_outputGradients[f * planeSize];
+
+				Scalar biasGradient = 0.0;
+
+				for( uint32_t i = 0 ; i < planeSize ; ++i )
+					biasGradient += dE_dN[i];
+
+				m_BiasGradients[f] += biasGradient;
+			}
+
+			//dE/dW[F x C] += dE/dN[F x HW] * In^T[HW x C]
+			Gemm( m_NumFeatureMaps, numChannels, planeSize, { _outputGradients.data(), planeSize, false }, { _layerInputs.data(), planeSize, true }, m_WeightGradients.data(), numChannels );
+
+			//dE/dI[C x HW] = W^T[C x F] * dE/dN[F x HW]
+			std::fill( _inputGradients.begin(), _inputGradients.end(), Scalar( 0.0 ) );
+			Gemm( numChannels, planeSize, m_NumFeatureMaps, { m_Weights.data(), numChannels, true }, { _outputGradients.data(), planeSize, false }, _inputGradients.data(), planeSize );
+		}
+
+		virtual void Load( std::istream& _stream ) override
+		{
+			WeightsAndBiasesLayer::Load( _stream );
+
+			Read( _stream, m_NumFeatureMaps );
+		}
+
+		virtual void Save( std::ostream& _stream ) const override
+		{
+			WeightsAndBiasesLayer::Save( _stream );
+
+			Write( _stream, m_NumFeatureMaps );
+		}
+
+		inline uint32_t GetNumFeatureMaps() const { return m_NumFeatureMaps; }
+
+	private:
+		//Output feature map _f for the _count pixels starting at _offset in the planes
+		inline void MixChannels( const Tensor& _in, Tensor& _out, uint32_t _f, uint32_t _offset, uint32_t _count ) const
+		{
+			const uint32_t numChannels = m_InputShape.m_SZ;
+			const uint32_t planeSize = m_InputShape.m_SX * m_InputShape.m_SY;
+
+			Scalar* out = &_out[_f * planeSize + _offset];
+
+			for( uint32_t i = 0 ; i < _count ; ++i )
+				out[i] = m_Biases[_f];
+
+			for( uint32_t c = 0 ; c < numChannels ; ++c )
+			{
+				const Scalar w = m_Weights[_f * numChannels + c];
+				const Scalar* in = &_in[c * planeSize + _offset];
+
+				for( uint32_t i = 0 ; i < _count ; ++i )
+					out[i] += w * in[i];
+			}
+		}
+
+	private:
+		uint32_t m_NumFeatureMaps;
+	};
+}
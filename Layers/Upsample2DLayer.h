@@ -0,0 +1,179 @@
+#pragma once
+
+#include "Layer.h"
+
+namespace ToyDNN
+{
+	enum class UpsampleMode : uint32_t
+	{
+		Nearest,
+		Bilinear //Pixel centers are aligned, borders are clamped
+	};
+
+	//Resize by an integer factor. Followed by a Convolution2D, it's a decoder building block without the checkerboard artifacts of
+	//ConvolutionTranspose2D. At inference the convolution then reads the low resolution input directly (see Convolution2D::ForwardUpsampled).
+	class Upsample2D : public Layer
+	{
+	public:
+		Upsample2D( uint32_t _factor = 2, UpsampleMode _mode = UpsampleMode::Nearest ) :
+			m_Factor( _factor ), m_Mode( _mode )
+		{
+			assert( _factor > 0 );
+		}
+
+		virtual LayerType GetType() const override { return LayerType::Upsample2D; }
+		virtual const char* GetName() const override { return "Upsample2D"; }
+		virtual bool BackPropagationNeedsInput() const override { return false; }
+
+		virtual void Setup( const TensorShape& _previousLayerOutputShape, uint32_t _outputPadding ) override
+		{
+			assert( _outputPadding == 0 );
+			assert( _previousLayerOutputShape.m_Padding == 0 );
+
+			m_InputShape = _previousLayerOutputShape;
+			m_OutputShape = TensorShape( m_InputShape.m_SX * m_Factor, m_InputShape.m_SY * m_Factor, m_InputShape.m_SZ );
+
+			SetupSamples();
+		}
+
+		virtual bool Reshape( const TensorShape& _inputShape ) override
+		{
+			Setup( _inputShape, 0 );
+			return true;
+		}
+
+		virtual void Forward( const Tensor& _in, Tensor& _out ) const override
+		{
+			ForwardRegion( _in, _out, Region::Whole( m_OutputShape ) );
+		}
+
+		virtual Region GetAffectedOutputRegion( const Region& _inputRegion ) const override
+		{
+			if( _inputRegion.IsEmpty() )
+				return Region();
+
+			//Bilinear outputs blend with the neighbor input pixels
+			const uint32_t margin = m_Mode == UpsampleMode::Bilinear ? 1 : 0;
+
+			return Region( (_inputRegion.X0 - std::min( _inputRegion.X0, margin )) * m_Factor,
+						   (_inputRegion.Y0 - std::min( _inputRegion.Y0, margin )) * m_Factor,
+						   std::min( _inputRegion.X1 + margin, m_InputShape.m_SX ) * m_Factor,
+						   std::min( _inputRegion.Y1 + margin, m_InputShape.m_SY ) * m_Factor );
+		}
+
+		virtual void ForwardRegion( const Tensor& _in, Tensor& _out, const Region& _outputRegion ) const override
+		{
+			for( uint32_t z = 0 ; z < m_OutputShape.m_SZ ; ++z )
+			{
+				for( uint32_t y = _outputRegion.Y0 ; y < _outputRegion.Y1 ; ++y )
+				{
+					for( uint32_t x = _outputRegion.X0 ; x < _outputRegion.X1 ; ++x )
+					{
+						_out[m_OutputShape.Index( x, y, z )] = Sample( _in, x, y, z );
+					}
+				}
+			}
+		}
+
+		virtual void BackPropagation( const Tensor& _layerInputs, const Tensor& _layerOutputs, const Tensor& _outputGradients, Tensor& _inputGradients ) override
+		{
+			std::fill( _inputGradients.begin(), _inputGradients.end(), Scalar( 0.0 ) );
+
+			for( uint32_t z = 0 ; z < m_OutputShape.m_SZ ; ++z )
+			{
+				for( uint32_t y = 0 ; y < m_OutputShape.m_SY ; ++y )
+				{
+					const SamplePoint& sy = m_SamplesY[y];
+
+					for( uint32_t x = 0 ; x < m_OutputShape.m_SX ; ++x )
+					{
+						const SamplePoint& sx = m_SamplesX[x];
+						const Scalar gradient = _outputGradients[m_OutputShape.Index( x, y, z )];
+
+						_inputGradients[m_InputShape.Index( sx.I0, sy.I0, z )] += gradient * (Scalar( 1.0 ) - sx.Weight) * (Scalar( 1.0 ) - sy.Weight);
+						_inputGradients[m_InputShape.Index( sx.I1, sy.I0, z )] += gradient * sx.Weight * (Scalar( 1.0 ) - sy.Weight);
+						_inputGradients[m_InputShape.Index( sx.I0, sy.I1, z )] += gradient * (Scalar( 1.0 ) - sx.Weight) * sy.Weight;
+						_inputGradients[m_InputShape.Index( sx.I1, sy.I1, z )] += gradient * sx.Weight * sy.Weight;
+					}
+				}
+			}
+		}
+
+		//Value of the upsampled tensor at (_x, _y, _z), read from the low resolution tensor _in
+		inline Scalar Sample( const Tensor& _in, uint32_t _x, uint32_t _y, uint32_t _z ) const
+		{
+			const SamplePoint& sx = m_SamplesX[_x];
+			const SamplePoint& sy = m_SamplesY[_y];
+
+			if( m_Mode == UpsampleMode::Nearest )
+				return _in[m_InputShape.Index( sx.I0, sy.I0, _z )];
+
+			const Scalar top = _in[m_InputShape.Index( sx.I0, sy.I0, _z )] + sx.Weight * (_in[m_InputShape.Index( sx.I1, sy.I0, _z )] - _in[m_InputShape.Index( sx.I0, sy.I0, _z )]);
+			const Scalar bottom = _in[m_InputShape.Index( sx.I0, sy.I1, _z )] + sx.Weight * (_in[m_InputShape.Index( sx.I1, sy.I1, _z )] - _in[m_InputShape.Index( sx.I0, sy.I1, _z )]);
+
+			return top + sy.Weight * (bottom - top);
+		}
+
+		virtual void Load( std::istream& _stream ) override
+		{
+			Layer::Load( _stream );
+
+			Read( _stream, m_Factor );
+			Read( _stream, m_Mode );
+
+			SetupSamples();
+		}
+
+		virtual void Save( std::ostream& _stream ) const override
+		{
+			Layer::Save( _stream );
+
+			Write( _stream, m_Factor );
+			Write( _stream, m_Mode );
+		}
+
+	private:
+		//Output coordinate x blends input coordinates I0 and I1, nearest sampling only reads I0
+		struct SamplePoint
+		{
+			uint32_t I0, I1;
+			Scalar Weight; //Of I1
+		};
+
+		void SetupSamples()
+		{
+			auto setupAxis = [&]( uint32_t _inputSize, std::vector< SamplePoint >& _samples )
+			{
+				_samples.resize( _inputSize * m_Factor );
+
+				for( uint32_t x = 0 ; x < _samples.size() ; ++x )
+				{
+					SamplePoint& s = _samples[x];
+
+					if( m_Mode == UpsampleMode::Nearest )
+					{
+						s.I0 = s.I1 = x / m_Factor;
+						s.Weight = Scalar( 0.0 );
+						continue;
+					}
+
+					//Center of output pixel x in input coordinates
+					Scalar source = (Scalar( x ) + Scalar( 0.5 )) / Scalar( m_Factor ) - Scalar( 0.5 );
+					source = std::max( source, Scalar( 0.0 ) );
+
+					s.I0 = std::min( (uint32_t)source, _inputSize - 1 );
+					s.I1 = std::min( s.I0 + 1, _inputSize - 1 );
+					s.Weight = s.I1 > s.I0 ? source - Scalar( s.I0 ) : Scalar( 0.0 );
+				}
+			};
+
+			setupAxis( m_InputShape.m_SX, m_SamplesX );
+			setupAxis( m_InputShape.m_SY, m_SamplesY );
+		}
+
+	private:
+		uint32_t m_Factor;
+		UpsampleMode m_Mode;
+		std::vector< SamplePoint > m_SamplesX, m_SamplesY;
+	};
+}
@@ -0,0 +1,29 @@
+#include "pch.h"
+#include "ModelRegistry.h"
+#include "InferenceContext.h"
+
+namespace ToyDNN
+{
+	bool ModelRegistry::Load( const char* _filename )
+	{
+		//Slow part, done before anything is visible to readers
+		std::shared_ptr< const NeuralNetwork > network = LoadInferenceNetwork( _filename );
+
+		if( !network )
+			return false;
+
+		Publish( std::move( network ) );
+
+		Log( "Published %s as model version %llu\n", _filename, GetVersion() );
+
+		return true;
+	}
+
+	void ModelRegistry::Publish( std::shared_ptr< const NeuralNetwork > _network )
+	{
+		assert( _network );
+
+		std::atomic_store( &m_Network, std::move( _network ) );
+		++m_Version;
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+#include <memory>
+#include <atomic>
+
+namespace ToyDNN
+{
+	//Holds the model currently being served and replaces it without stopping readers.
+	//A new model is loaded on the side then published with an atomic pointer swap, readers that acquired the previous one
+	//keep using it until they release it, the last one frees it.
+	class ModelRegistry
+	{
+	public:
+		ModelRegistry() {}
+
+		ModelRegistry( const ModelRegistry& ) = delete;
+		ModelRegistry& operator=( const ModelRegistry& ) = delete;
+
+		//Load an inference-only network and publish it, the current model is left untouched on failure
+		bool Load( const char* _filename );
+		void Publish( std::shared_ptr< const NeuralNetwork > _network );
+
+		//Model to use for one request, never blocks on Load()
+		std::shared_ptr< const NeuralNetwork > Acquire() const { return std::atomic_load( &m_Network ); }
+
+		//Incremented by each Publish(), 0 until a model is published
+		uint64_t GetVersion() const { return m_Version.load(); }
+
+	private:
+		std::shared_ptr< const NeuralNetwork > m_Network; //Only accessed with atomic_load/atomic_store
+		std::atomic< uint64_t > m_Version = { 0 };
+	};
+}
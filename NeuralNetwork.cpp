@@ -4,7 +4,10 @@
 #include "BMP.h"
 #include <chrono>
 #include <fstream>
-#include "Layers/PaddingLayer.h"
+#include <sstream>
+#include "DataAugmentation.h"
+#include "ThreadPool.h"
+#include "ConvolutionTuner.h"
 
 
 /*
@@ -66,38 +69,112 @@ namespace ToyDNN
 		m_Layers.push_back( std::unique_ptr<Layer>( _layer ) );
 	}
 
-	void NeuralNetwork::Compile( const TensorShape& _inputShape )
+	void NeuralNetwork::Compile( const TensorShape& _inputShape, bool _prePaddedInput )
 	{
 		assert( !m_Layers.empty() );
 		assert( _inputShape.m_Padding == 0 );
 
 		Log( "Compiling network (%d explicit layers):\n", m_Layers.size() );
 
+		m_IsCheckpoint.clear(); //Placement depends on layer shapes
+
 		uint32_t padding = m_Layers[0]->GetInputPadding();
-		if( padding > 0 )
+		TensorShape inputShape = _inputShape;
+
+		if( (padding > 0) && _prePaddedInput )
 		{
-			//insert an implicit padding layer at the start of the network
-			m_Layers.insert( m_Layers.begin(), std::unique_ptr<Layer>( new PaddingLayer() ) );
+			//Samples are padded by the dataset, the first layer can then skip border handling
+			inputShape = TensorShape( _inputShape.m_SX + padding, _inputShape.m_SY + padding, _inputShape.m_SZ, padding );
+
+			Log( "Input is expected pre-padded (padding=%d)\n", padding );
 		}
 
-		m_Layers[0]->Setup( _inputShape, padding );
+		//Layers handle padding of their input virtually, activations are stored without padding
+		m_Layers[0]->Setup( inputShape, 0 );
 		m_Layers[0]->PrintIOShape();
 
 		for( uint32_t i = 1 ; i < m_Layers.size() ; ++i )
 		{
-			if( i + 1 == m_Layers.size() )
-			{
-				//No padding for last layer output
-				padding = 0;
-			}
-			else
-			{
-				padding = m_Layers[i + 1]->GetInputPadding();
-			}
-
-			m_Layers[i]->Setup( m_Layers[i - 1]->GetOutputShape(), padding );
+			m_Layers[i]->Setup( m_Layers[i - 1]->GetOutputShape(), 0 );
 			m_Layers[i]->PrintIOShape();
 		}
+
+		TuneLayers();
+		AllocateTrainingResources();
+		OnWeightsChanged();
+	}
+
+	void NeuralNetwork::TuneLayers()
+	{
+		if( m_TuningCacheFilename.empty() )
+			return;
+
+		ConvolutionTuner tuner( m_TuningCacheFilename.c_str() );
+
+		for( auto& layer : m_Layers )
+		{
+			if( layer->GetType() == LayerType::Convolution2D )
+				tuner.Tune( static_cast< Convolution2D& >( *layer ) );
+		}
+
+		if( !tuner.Save() )
+			Log( "Failed to save the tuning cache %s !\n", m_TuningCacheFilename.c_str() );
+
+		Log( "Autotuning: %d cached plans, %d layers measured\n", tuner.GetNumHits(), tuner.GetNumMisses() );
+	}
+
+	void NeuralNetwork::OnWeightsChanged()
+	{
+		//Shared by all networks so that a version identifies both the network and its weights
+		static std::atomic< uint64_t > s_LastWeightsVersion = { 0 };
+
+		m_WeightsVersion = ++s_LastWeightsVersion;
+	}
+
+	void NeuralNetwork::AllocateTrainingResources()
+	{
+		for( auto& layer : m_Layers )
+			layer->AllocateTrainingResources();
+
+		m_LayerOutputs.clear();
+		m_LayerOutputs.resize( m_Layers.size() );
+
+		m_IsInferenceOnly = false;
+	}
+
+	void NeuralNetwork::ReleaseTrainingResources()
+	{
+		assert( !m_IsTraining );
+
+		for( auto& layer : m_Layers )
+			layer->ReleaseTrainingResources();
+
+		std::vector< Tensor >().swap( m_LayerOutputs );
+		m_IsCheckpoint.clear();
+
+		m_IsInferenceOnly = true;
+	}
+
+	void NeuralNetwork::PadInput( const Tensor& _in, Tensor& _out ) const
+	{
+		if( IsInputPrePadded() )
+			CopyToPaddedTensor( _in, GetInputShape(), _out );
+		else
+			_out = _in;
+	}
+
+	void NeuralNetwork::PadDataSet( std::vector<Tensor>& _dataSet ) const
+	{
+		if( !IsInputPrePadded() )
+			return;
+
+		#pragma omp parallel for
+		for( int i = 0 ; i < (int)_dataSet.size() ; ++i )
+		{
+			Tensor padded;
+			CopyToPaddedTensor( _dataSet[i], GetInputShape(), padded );
+			_dataSet[i].swap( padded );
+		}
 	}
 
 	void NeuralNetwork::Train(  Optimizer& _optimizer,
@@ -110,6 +187,8 @@ namespace ToyDNN
 	{
 		assert( _trainingSet.size() == _trainingSetExpectedOutput.size() );
 		assert( _validationSet.size() == _validationSetExpectedOutput.size() );
+		assert( !IsInputPrePadded() || (&_trainingSet != &_trainingSetExpectedOutput) ); //Padded samples can't be expected outputs
+		assert( !m_IsInferenceOnly );
 		
 		m_IsTraining = true;
 		m_StopTraining = false;
@@ -134,15 +213,33 @@ namespace ToyDNN
 
 				auto start = std::chrono::steady_clock::now();
 
+				const std::vector<Tensor>* augmentedBatch = nullptr;
+
+				if( m_AugmentationPipeline )
+				{
+					augmentedBatch = &m_AugmentationPipeline->GetBatch( _trainingSet, m_History.NumEpochCompleted, batch * _batchSize, batchSize );
+
+					//Let the workers prepare the next batch while we train on this one
+					if( batch + 1 < numTrainingSamples / _batchSize )
+						m_AugmentationPipeline->Prefetch( _trainingSet, m_History.NumEpochCompleted, (batch + 1) * _batchSize, batchSize );
+					else
+						m_AugmentationPipeline->Prefetch( _trainingSet, m_History.NumEpochCompleted + 1, 0, std::min( _batchSize, numTrainingSamples ) );
+				}
+
+				const bool isAutoEncoder = &_trainingSet == &_trainingSetExpectedOutput;
+
 				for( uint32_t batchSample = m_History.NumSamplesCompleted - batch * batchSize ; batchSample < batchSize ; ++batchSample )
 				{
 					uint32_t sampleIndex = batch * _batchSize + batchSample;
 
 					//Log( "epoch: %d sample: %d/%d\n", m_History.NumEpochCompleted, sampleIndex, numTrainingSamples );
 
-					Evaluate( _trainingSet[sampleIndex], out, true );
-					trainingError += ComputeError( out, _trainingSetExpectedOutput[sampleIndex] );
-					BackPropagation( _trainingSet[sampleIndex], _trainingSetExpectedOutput[sampleIndex] );
+					const Tensor& input = augmentedBatch ? (*augmentedBatch)[batchSample] : _trainingSet[sampleIndex];
+					const Tensor& expectedOutput = (augmentedBatch && isAutoEncoder) ? input : _trainingSetExpectedOutput[sampleIndex];
+
+					Evaluate( input, out, true );
+					trainingError += ComputeError( out, expectedOutput );
+					BackPropagation( input, expectedOutput );
 				
 					++m_History.NumSamplesCompleted;
 				}
@@ -212,44 +309,195 @@ namespace ToyDNN
 
 	void NeuralNetwork::Evaluate( const Tensor& _in, Tensor& _out, bool _cacheLayersOutput ) const
 	{
-		Tensor tmpTensor[2];
-		uint32_t curTensor = 0;
+		assert( !_cacheLayersOutput || !m_IsInferenceOnly );
 
-		for( uint32_t layer = 0 ; layer < m_Layers.size() ; ++layer )
+		EvaluationWorkspace workspace;
+		EvaluateLayers( _in, &_out, 0, (uint32_t)m_Layers.size(), _cacheLayersOutput, IsGradientCheckpointingEnabled(), workspace );
+	}
+
+	void NeuralNetwork::Evaluate( const Tensor& _in, Tensor& _out, EvaluationWorkspace& _workspace ) const
+	{
+		EvaluateLayers( _in, &_out, 0, (uint32_t)m_Layers.size(), false, false, _workspace );
+	}
+
+	void NeuralNetwork::EvaluateIncremental( const Tensor& _in, Tensor& _out, IncrementalEvaluationState& _state ) const
+	{
+		const uint32_t numLayers = (uint32_t)m_Layers.size();
+		const TensorShape& inputShape = GetInputShape();
+
+		assert( _in.size() == inputShape.Size() );
+
+		Region dirtyRegion;
+
+		if( (_state.WeightsVersion != GetWeightsVersion()) || (_state.Input.size() != _in.size()) )
 		{
-			const Tensor* tensorIn;
+			//First evaluation, or different weights: nothing can be reused
+			_state.WeightsVersion = GetWeightsVersion();
+			_state.LayerOutputs.resize( numLayers );
 
-			if( layer == 0 )
+			for( uint32_t i = 0 ; i < numLayers ; ++i )
+				_state.LayerOutputs[i].resize( m_Layers[i]->GetOutputShape().Size() );
+
+			dirtyRegion = Region::Whole( inputShape );
+		}
+		else
+		{
+			//Bounding box of the pixels that changed, in any channel
+			for( uint32_t i = 0 ; i < (uint32_t)_in.size() ; ++i )
 			{
-				tensorIn = &_in;
+				if( _in[i] != _state.Input[i] )
+					dirtyRegion.Add( i % inputShape.m_SX, (i / inputShape.m_SX) % inputShape.m_SY );
 			}
-			else
+		}
+
+		_state.Input = _in;
+
+		for( uint32_t layer = 0 ; (layer < numLayers) && !dirtyRegion.IsEmpty() ; ++layer )
+		{
+			const Tensor& in = layer == 0 ? _state.Input : _state.LayerOutputs[layer - 1];
+
+			dirtyRegion = m_Layers[layer]->GetAffectedOutputRegion( dirtyRegion );
+			m_Layers[layer]->ForwardRegion( in, _state.LayerOutputs[layer], dirtyRegion );
+		}
+
+		_out = _state.LayerOutputs.back();
+	}
+
+	//One workspace per pool thread, reused by every asynchronous evaluation it runs
+	static EvaluationWorkspace& GetPoolThreadWorkspace()
+	{
+		static thread_local EvaluationWorkspace workspace;
+		return workspace;
+	}
+
+	std::future< Tensor > NeuralNetwork::EvaluateAsync( Tensor _in ) const
+	{
+		auto in = std::make_shared< Tensor >( std::move( _in ) ); //Captured by a std::function, must be copyable
+
+		return GetSharedThreadPool().Enqueue( [this, in]()
+		{
+			Tensor out;
+			Evaluate( *in, out, GetPoolThreadWorkspace() );
+
+			return out;
+		} );
+	}
+
+	void NeuralNetwork::EvaluateAsync( Tensor _in, std::function< void( Tensor& _out ) > _onCompleted ) const
+	{
+		auto in = std::make_shared< Tensor >( std::move( _in ) );
+
+		GetSharedThreadPool().Enqueue( [this, in, _onCompleted]()
+		{
+			Tensor out;
+			Evaluate( *in, out, GetPoolThreadWorkspace() );
+
+			_onCompleted( out );
+		} );
+	}
+
+	void NeuralNetwork::EvaluateBatch( const std::vector< const Tensor* >& _in, std::vector< Tensor >& _out, std::vector< EvaluationWorkspace >& _workspaces ) const
+	{
+		const int batchSize = (int)_in.size();
+		const uint32_t numLayers = (uint32_t)m_Layers.size();
+
+		_out.resize( batchSize );
+		_workspaces.resize( batchSize );
+
+		int inBuffer = -1; //-1: network input, otherwise index in the workspace, same for every sample
+
+		for( uint32_t layer = 0 ; layer < numLayers ; ++layer )
+		{
+			if( IsFusedWithNextLayer( layer, numLayers ) )
+				continue; //Evaluated by the next layer
+
+			const Upsample2D* fusedUpsampling = (layer > 0) && IsFusedWithNextLayer( layer - 1, numLayers ) ? static_cast< const Upsample2D* >( m_Layers[layer - 1].get() ) : nullptr;
+			const bool isLastLayer = layer == numLayers - 1;
+			const bool inPlace = (inBuffer >= 0) && !isLastLayer && m_Layers[layer]->SupportsInPlace();
+			const int outBuffer = inPlace ? inBuffer : (inBuffer == 0 ? 1 : 0);
+			const uint32_t outputSize = m_Layers[layer]->GetOutputShape().Size();
+
+			#pragma omp parallel for
+			for( int i = 0 ; i < batchSize ; ++i )
 			{
-				tensorIn = &tmpTensor[1 - curTensor];
+				const Tensor& in = inBuffer < 0 ? *_in[i] : _workspaces[i].Buffers[inBuffer];
+				Tensor& out = isLastLayer ? _out[i] : _workspaces[i].Buffers[outBuffer];
+
+				out.resize( outputSize );
+
+				if( fusedUpsampling != nullptr )
+					static_cast< const Convolution2D* >( m_Layers[layer].get() )->ForwardUpsampled( in, *fusedUpsampling, out );
+				else
+					m_Layers[layer]->ForwardWithScratch( in, out, _workspaces[i].Scratch );
+
+				AssertIsFinite( out );
 			}
 
+			inBuffer = outBuffer;
+		}
+	}
+
+	void NeuralNetwork::EvaluateLayers( const Tensor& _in, Tensor* _out, uint32_t _firstLayer, uint32_t _endLayer, bool _storeLayersOutput, bool _storeCheckpointsOnly,
+										EvaluationWorkspace& _workspace ) const
+	{
+		Tensor* tmpTensor = _workspace.Buffers;
+		const Tensor* tensorIn = &_in;
+		const Upsample2D* fusedUpsampling = nullptr;
+
+		for( uint32_t layer = _firstLayer ; layer < _endLayer ; ++layer )
+		{
+			//The upsampled tensor is never stored, the convolution reads the low resolution one. Training keeps it for back propagation.
+			if( !_storeLayersOutput && IsFusedWithNextLayer( layer, _endLayer ) )
+			{
+				fusedUpsampling = static_cast< const Upsample2D* >( m_Layers[layer].get() );
+				continue;
+			}
+
+			const bool isLastLayer = layer == _endLayer - 1;
+			const bool storeOutput = _storeLayersOutput && IsLayerOutputStored( layer, _storeCheckpointsOnly );
+			const bool inputIsTemporary = (tensorIn == &tmpTensor[0]) || (tensorIn == &tmpTensor[1]);
+
 			Tensor* tensorOut;
 
-			if( layer == m_Layers.size() - 1 )
+			if( storeOutput )
+			{
+				tensorOut = &m_LayerOutputs[layer]; //Written in place for back propagation, no copy
+			}
+			else if( isLastLayer && (_out != nullptr) )
 			{
-				tensorOut = &_out;
+				tensorOut = _out;
+			}
+			else if( inputIsTemporary && m_Layers[layer]->SupportsInPlace() )
+			{
+				tensorOut = &tmpTensor[tensorIn == &tmpTensor[1]]; //The input is dead once consumed, overwrite it
 			}
 			else
 			{
-				tensorOut = &tmpTensor[curTensor];
+				tensorOut = &tmpTensor[tensorIn == &tmpTensor[0]]; //Ping pong
 			}
 
 			tensorOut->resize( m_Layers[layer]->GetOutputShape().Size() );
 
-			m_Layers[layer]->Forward( *tensorIn, *tensorOut );
+			if( _storeLayersOutput )
+				m_Layers[layer]->TrainingForward( *tensorIn, *tensorOut );
+			else if( fusedUpsampling != nullptr )
+				static_cast< const Convolution2D* >( m_Layers[layer].get() )->ForwardUpsampled( *tensorIn, *fusedUpsampling, *tensorOut );
+			else
+				m_Layers[layer]->ForwardWithScratch( *tensorIn, *tensorOut, _workspace.Scratch );
 
 			AssertIsFinite( *tensorOut );
 
-			if( _cacheLayersOutput )
-				m_Layers[layer]->CacheOutput( *tensorOut ); //For back propagation
-
-			curTensor = 1 - curTensor;//ping pong
+			tensorIn = tensorOut;
+			fusedUpsampling = nullptr;
 		}
+
+		if( (_out != nullptr) && (tensorIn != _out) )
+			*_out = *tensorIn;
+	}
+
+	bool NeuralNetwork::IsFusedWithNextLayer( uint32_t _layer, uint32_t _endLayer ) const
+	{
+		return (_layer + 1 < _endLayer) && (m_Layers[_layer]->GetType() == LayerType::Upsample2D) && (m_Layers[_layer + 1]->GetType() == LayerType::Convolution2D);
 	}
 
 	void NeuralNetwork::ClearGradients()
@@ -318,6 +566,17 @@ namespace ToyDNN
 	}
 
 
+	bool NeuralNetwork::IsOutputNeededForBackPropagation( uint32_t _layer ) const
+	{
+		//The last output is needed by the cost gradient
+		return (_layer == m_Layers.size() - 1) || m_Layers[_layer]->BackPropagationNeedsOutput() || m_Layers[_layer + 1]->BackPropagationNeedsInput();
+	}
+
+	bool NeuralNetwork::IsLayerOutputStored( uint32_t _layer, bool _checkpointsOnly ) const
+	{
+		return _checkpointsOnly ? m_IsCheckpoint[_layer] : IsOutputNeededForBackPropagation( _layer );
+	}
+
 	void NeuralNetwork::BackPropagation( const Tensor& _input, const Tensor& _expectedOutput )
 	{
 		Tensor outputGradients[2];
@@ -327,7 +586,7 @@ namespace ToyDNN
 
 		const uint32_t numOutputs = (uint32_t)_expectedOutput.size();
 		outputGradients[0].resize( numOutputs );
-		const Tensor& output = m_Layers[m_Layers.size() - 1]->GetOutput();
+		const Tensor& output = m_LayerOutputs.back();
 
 		assert( numOutputs == output.size() );
 
@@ -340,6 +599,9 @@ namespace ToyDNN
 
 		for( int layer = (int)m_Layers.size() - 1 ; layer >= 0 ; --layer )
 		{
+			if( IsGradientCheckpointingEnabled() && m_IsCheckpoint[layer] )
+				RecomputeSegment( _input, layer );
+
 			const Tensor* tensorIn;
 
 			if( layer == 0 )
@@ -348,17 +610,146 @@ namespace ToyDNN
 			}
 			else
 			{
-				tensorIn = &m_Layers[layer - 1]->GetOutput();
+				tensorIn = &m_LayerOutputs[layer - 1];
 			}
 
-			outputGradients[1 - curTensor].resize( m_Layers[layer]->GetInputShape().Size() );
+			const Tensor& layerOutput = m_LayerOutputs[layer];
+
+			if( m_Layers[layer]->SupportsInPlace() )
+			{
+				m_Layers[layer]->BackPropagation( *tensorIn, layerOutput, outputGradients[curTensor], outputGradients[curTensor] );
+
+				AssertIsFinite( outputGradients[curTensor] );
+			}
+			else
+			{
+				outputGradients[1 - curTensor].resize( m_Layers[layer]->GetInputShape().Size() );
+
+				m_Layers[layer]->BackPropagation( *tensorIn, layerOutput, outputGradients[curTensor], outputGradients[1 - curTensor] );
+
+				AssertIsFinite( outputGradients[1 - curTensor] );
+
+				curTensor = 1 - curTensor; //Ping pong
+			}
+
+			//Both consumers of this output are done, free it so that only one segment is alive at a time
+			if( IsGradientCheckpointingEnabled() && (layer < (int)m_Layers.size() - 1) )
+				Tensor().swap( m_LayerOutputs[layer] );
+		}
+	}
+
+	void NeuralNetwork::RecomputeSegment( const Tensor& _input, uint32_t _checkpointLayer )
+	{
+		//Layers after the previous checkpoint, up to this one, didn't keep their outputs
+		uint32_t firstLayer = _checkpointLayer;
+
+		while( (firstLayer > 0) && !m_IsCheckpoint[firstLayer - 1] )
+			--firstLayer;
+
+		if( firstLayer == _checkpointLayer )
+			return;
+
+		const Tensor& segmentInput = firstLayer == 0 ? _input : m_LayerOutputs[firstLayer - 1];
+
+		EvaluationWorkspace workspace;
+		EvaluateLayers( segmentInput, nullptr, firstLayer, _checkpointLayer, true, false, workspace );
+	}
+
+	void NeuralNetwork::EnableGradientCheckpointing( size_t _memoryBudget )
+	{
+		assert( !m_Layers.empty() );
+
+		m_IsCheckpoint.clear();
+
+		if( _memoryBudget == 0 )
+			return;
+
+		const uint32_t numLayers = (uint32_t)m_Layers.size();
+		std::vector< size_t > outputBytes( numLayers ), neededBytes( numLayers );
+		size_t totalNeededBytes = 0;
+
+		for( uint32_t i = 0 ; i < numLayers ; ++i )
+		{
+			outputBytes[i] = m_Layers[i]->GetOutputShape().Size() * sizeof( Scalar );
+			neededBytes[i] = IsOutputNeededForBackPropagation( i ) ? outputBytes[i] : 0;
+			totalNeededBytes += neededBytes[i];
+		}
+
+		if( totalNeededBytes <= _memoryBudget )
+		{
+			Log( "Gradient checkpointing not needed, cached outputs take %zu KB\n", totalNeededBytes / 1024 );
+			return;
+		}
+
+		//Greedy placement: walk the layers and make a checkpoint of the layer which would make the current segment exceed maxSegmentBytes.
+		//Peak memory is then the sum of checkpoints plus the largest segment being recomputed.
+		//Every segment size is tried, we keep the placement fitting the budget with the least recomputation.
+		std::vector< bool > isCheckpoint;
+		size_t bestPeakBytes = SIZE_MAX, bestRecomputedBytes = SIZE_MAX;
+		bool bestFits = false;
 
-			m_Layers[layer]->BackPropagation( *tensorIn, outputGradients[curTensor], outputGradients[1 - curTensor] );
+		for( uint32_t first = 0 ; first < numLayers - 1 ; ++first )
+		{
+			size_t maxSegmentBytes = 0;
+
+			for( uint32_t last = first ; last < numLayers - 1 ; ++last )
+			{
+				maxSegmentBytes += neededBytes[last];
+
+				std::vector< bool > candidate( numLayers, false );
+				candidate[numLayers - 1] = true;
+
+				size_t checkpointBytes = outputBytes[numLayers - 1], segmentBytes = 0, peakSegmentBytes = 0, recomputedBytes = 0;
+
+				for( uint32_t i = 0 ; i < numLayers - 1 ; ++i )
+				{
+					if( segmentBytes + neededBytes[i] > maxSegmentBytes )
+					{
+						candidate[i] = true;
+						checkpointBytes += outputBytes[i];
+						peakSegmentBytes = std::max( peakSegmentBytes, segmentBytes );
+						segmentBytes = 0;
+					}
+					else
+					{
+						segmentBytes += neededBytes[i];
+						recomputedBytes += outputBytes[i];
+					}
+				}
+
+				peakSegmentBytes = std::max( peakSegmentBytes, segmentBytes );
+
+				const size_t peakBytes = checkpointBytes + peakSegmentBytes;
+				const bool fits = peakBytes <= _memoryBudget;
 
-			AssertIsFinite( outputGradients[1 - curTensor] );
+				bool isBetter;
 
-			curTensor = 1 - curTensor; //Ping pong
+				if( fits != bestFits )
+					isBetter = fits;
+				else if( fits )
+					isBetter = (recomputedBytes < bestRecomputedBytes) || ((recomputedBytes == bestRecomputedBytes) && (peakBytes < bestPeakBytes));
+				else
+					isBetter = peakBytes < bestPeakBytes;
+
+				if( isBetter )
+				{
+					isCheckpoint.swap( candidate );
+					bestPeakBytes = peakBytes;
+					bestRecomputedBytes = recomputedBytes;
+					bestFits = fits;
+				}
+			}
 		}
+
+		m_IsCheckpoint.swap( isCheckpoint );
+
+		uint32_t numCheckpoints = (uint32_t)std::count( m_IsCheckpoint.begin(), m_IsCheckpoint.end(), true );
+
+		Log( "Gradient checkpointing: %d checkpoints, peak activation memory %zu KB instead of %zu KB, %zu KB recomputed per sample\n",
+			 numCheckpoints, bestPeakBytes / 1024, totalNeededBytes / 1024, bestRecomputedBytes / 1024 );
+
+		if( !bestFits )
+			Log( "Warning: the gradient checkpointing budget (%zu KB) can't be met\n", _memoryBudget / 1024 );
 	}
 
 	void NeuralNetwork::ScaleGradients( Scalar _scale )
@@ -371,6 +762,8 @@ namespace ToyDNN
 	{
 		for( auto& layer : m_Layers )
 			layer->ApplyGradients( _optimizer );
+
+		OnWeightsChanged();
 	}
 
 	void NeuralNetwork::PrintStatistics() const
@@ -397,7 +790,7 @@ namespace ToyDNN
 		m_History.BestAccuracy = 0.0f;
 	}
 
-	bool NeuralNetwork::Load( const char* _filename )
+	bool NeuralNetwork::Load( const char* _filename, bool _inferenceOnly )
 	{
 		std::ifstream fileStream( _filename, std::ios::in | std::ios::binary );
 
@@ -405,11 +798,37 @@ namespace ToyDNN
 			return false;
 
 		m_Layers.clear();
+		m_IsCheckpoint.clear();
+		OnWeightsChanged(); //Even if loading fails
 
 		try
 		{
 			ClearHistory();
 
+			uint32_t magic = 0;
+			Read( fileStream, magic );
+
+			if( magic == c_FileFormatMagic )
+			{
+				FileFormatVersion version;
+				Read( fileStream, version );
+
+				if( version > FileFormatVersion::Current )
+				{
+					Log( "%s was saved by a newer version (file format %d) !\n", _filename, (uint32_t)version );
+					return false;
+				}
+
+				SetFileFormatVersion( fileStream, version );
+			}
+			else
+			{
+				//No header, the file starts with the first layer
+				fileStream.clear();
+				fileStream.seekg( 0 );
+				SetFileFormatVersion( fileStream, FileFormatVersion::Legacy );
+			}
+
 			while( true )
 			{
 				LayerType layerType;
@@ -431,9 +850,54 @@ namespace ToyDNN
 			return false;
 		}
 
+		TuneLayers();
+
+		//The new layers allocated nothing, only the activations of the previous network are freed
+		if( _inferenceOnly )
+			ReleaseTrainingResources();
+		else
+			AllocateTrainingResources();
+
 		return true;
 	}
 
+	std::unique_ptr< NeuralNetwork > NeuralNetwork::CloneWithInputShape( const TensorShape& _inputShape, bool _autotune ) const
+	{
+		std::unique_ptr< NeuralNetwork > clone( new NeuralNetwork() );
+		TensorShape shape = _inputShape;
+
+		for( const auto& layer : m_Layers )
+		{
+			//Copy hyper parameters and weights the way Save() and Load() do
+			std::stringstream stream( std::ios::in | std::ios::out | std::ios::binary );
+			layer->Save( stream );
+
+			Layer* layerCopy = CreateLayer( layer->GetType() );
+			layerCopy->Load( stream );
+			clone->m_Layers.push_back( std::unique_ptr<Layer>( layerCopy ) );
+
+			if( !layerCopy->Reshape( shape ) )
+			{
+				Log( "Can't evaluate a %s layer on another input size\n", layer->GetName() );
+				return nullptr;
+			}
+
+			shape = layerCopy->GetOutputShape();
+		}
+
+		clone->m_IsInferenceOnly = true;
+
+		if( _autotune )
+		{
+			clone->m_TuningCacheFilename = m_TuningCacheFilename;
+			clone->TuneLayers();
+		}
+
+		clone->OnWeightsChanged();
+
+		return clone;
+	}
+
 	bool NeuralNetwork::Save( const char* _filename, bool _saveTrainingHistory ) const
 	{
 		std::ofstream fileStream( _filename, std::ios::out | std::ios::binary );
@@ -445,6 +909,9 @@ namespace ToyDNN
 		{
 			//TODO if( _saveTrainingHistory )
 
+			Write( fileStream, c_FileFormatMagic );
+			Write( fileStream, FileFormatVersion::Current );
+
 			for( const auto& layer : m_Layers )
 			{
 				Write( fileStream, layer->GetType() );
@@ -501,10 +968,12 @@ namespace ToyDNN
 		
 			//Compute Loss( param + epsilon )
 			*pParameter = originalParamValue + epsilon;
+			m_Layers[randomLayer]->OnParametersModified();
 			Scalar error1 = ComputeError( _dataSet, _dataSetExpectedOutput );
 
 			//Compute Loss( param - epsilon )
 			*pParameter = originalParamValue - epsilon;
+			m_Layers[randomLayer]->OnParametersModified();
 			Scalar error2 = ComputeError( _dataSet, _dataSetExpectedOutput );
 
 			//Compute gradient
@@ -526,6 +995,7 @@ namespace ToyDNN
 
 			//restore the parameter
 			*pParameter = originalParamValue;
+			m_Layers[randomLayer]->OnParametersModified();
 		}
 
 		Log( "%.2f%% of gradients were bad\n", (100.0f * badGradients) / (float)_numRandomParametersToCheck );
@@ -3,18 +3,56 @@
 #include "Layers/Activation/ActivationLayers.h"
 #include "Layers/FullyConnectedLayer.h"
 #include "Layers/Convolution2DLayer.h"
+#include "Layers/SeparableConvolution2DLayer.h"
 #include "Layers/MaxPoolingLayer.h"
+#include "Layers/Upsample2DLayer.h"
 #include <memory>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <string>
 
 namespace ToyDNN
 {
+	class AugmentationPipeline;
+
+	//Temporary buffers of an evaluation, reusing them across calls saves allocations
+	struct EvaluationWorkspace
+	{
+		Tensor Buffers[2];
+		Tensor Scratch; //Temporary memory of a layer (see Layer::ForwardWithScratch())
+	};
+
+	//Input and layer outputs of the previous incremental evaluation
+	struct IncrementalEvaluationState
+	{
+		uint64_t WeightsVersion = 0;
+		Tensor Input;
+		std::vector< Tensor > LayerOutputs;
+	};
 
 	class NeuralNetwork
 	{
 	public:
 		void AddLayer( Layer* _layer );
 
-		void Compile( const TensorShape& _inputShape );
+		//When the first layer reads padded inputs, it handles the borders itself (slower than the interior of the image).
+		//With _prePaddedInput, samples must instead be provided already padded (see PadInput() and PadDataSet())
+		//which saves that work for datasets that are evaluated many times. This is recorded in saved models.
+		void Compile( const TensorShape& _inputShape, bool _prePaddedInput = false );
+
+		//Compile(), Load() and CloneWithInputShape() then time the implementations of each Convolution2D layer on this CPU and keep the fastest
+		//(see ConvolutionTuner). Results are cached in _cacheFilename, shapes already measured on this CPU start with their plan instantly.
+		//nullptr disables it.
+		void EnableAutotuning( const char* _cacheFilename ) { m_TuningCacheFilename = _cacheFilename ? _cacheFilename : ""; }
+
+		//Layout expected by Evaluate() and Train(), including padding when the network takes pre-padded inputs
+		const TensorShape& GetInputShape() const { return m_Layers[0]->GetInputShape(); }
+		bool IsInputPrePadded() const { return GetInputShape().m_Padding > 0; }
+
+		//Convert unpadded samples to the layout expected by the network, no-op unless IsInputPrePadded()
+		void PadInput( const Tensor& _in, Tensor& _out ) const;
+		void PadDataSet( std::vector<Tensor>& _dataSet ) const;
 
 		//Return error metric
 		void Train(	 Optimizer& _optimizer,
@@ -30,13 +68,41 @@ namespace ToyDNN
 
 		void Evaluate( const Tensor& _in, Tensor& _out, bool _cacheLayersOutput=false ) const;
 
+		//Inference doesn't modify the network, several threads can evaluate it concurrently with their own workspace (see InferenceContext)
+		void Evaluate( const Tensor& _in, Tensor& _out, EvaluationWorkspace& _workspace ) const;
+
+		//Evaluate a batch layer by layer: each layer's weights are streamed once for the whole batch, samples are processed in parallel
+		//_workspaces is resized to one workspace per sample, keep it around to avoid allocations
+		void EvaluateBatch( const std::vector< const Tensor* >& _in, std::vector< Tensor >& _out, std::vector< EvaluationWorkspace >& _workspaces ) const;
+
+		//For inputs that change a little between calls (interactive edits): only the pixels depending on the ones that changed since
+		//the previous call with _state are evaluated again, following receptive fields through spatially local layers
+		//(convolutions, pooling, activations). Other layers, like FullyConnected, are fully evaluated once reached.
+		void EvaluateIncremental( const Tensor& _in, Tensor& _out, IncrementalEvaluationState& _state ) const;
+
+		//Evaluate on the library thread pool (see GetSharedThreadPool()), the caller isn't blocked and many requests can be in flight.
+		//The network must stay alive and must not be trained or loaded until the result is delivered.
+		std::future< Tensor > EvaluateAsync( Tensor _in ) const;
+		void EvaluateAsync( Tensor _in, std::function< void( Tensor& _out ) > _onCompleted ) const; //_onCompleted runs on a pool thread
+
+		//Limit the memory taken by cached layer outputs of a training sample: only the outputs of a few checkpoint layers are kept
+		//during the forward pass, layers in between are evaluated again during back propagation.
+		//Checkpoints are placed from the shapes of the layers, call after Compile() or Load(). 0 disables it.
+		void EnableGradientCheckpointing( size_t _memoryBudget );
+		bool IsGradientCheckpointingEnabled() const { return !m_IsCheckpoint.empty(); }
+
 		static void ComputeError( const Tensor& _out, const Tensor& _expectedOutput, Tensor& _error );
 		static Scalar ComputeError( const Tensor& _out, const Tensor& _expectedOutput );
 		Scalar ComputeError( const std::vector<Tensor>& _validationSet, const std::vector<Tensor>& _validationSetExpectedOutput );
 
 		void EnableClassificationAccuracyLog() { m_EnableClassificationAccuracyLog = true; }
 
+		//Training samples go through this pipeline before being fed to the network (not owned, nullptr to disable)
+		//When the training set is also the expected output (autoencoders), the augmented sample is used as expected output too
+		void SetAugmentationPipeline( AugmentationPipeline* _pipeline ) { m_AugmentationPipeline = _pipeline; }
+
 		const Layer* DbgGetLayer( uint32_t _idx ) const { return m_Layers[_idx].get(); }
+		const Tensor& DbgGetLayerOutput( uint32_t _idx ) const { return m_LayerOutputs[_idx]; } //Last training sample, empty if the output wasn't needed by back propagation
 		uint32_t DbgGetLayerCount() const { return (uint32_t)m_Layers.size(); }
 		void PrintStatistics() const;
 
@@ -63,23 +129,52 @@ namespace ToyDNN
 
 		const History& GetHistory() const { return m_History; }
 
-		bool Load( const char* _filename );
+		//Changes each time the weights change (Compile(), Load(), every training step), never reused by another network
+		uint64_t GetWeightsVersion() const { return m_WeightsVersion.load(); }
+
+		//Inference only copy of a fully convolutional network taking inputs of another size (unpadded), nullptr if a layer depends on the input size.
+		//The copy is autotuned like this network unless _autotune is false, for copies only used for their shapes.
+		std::unique_ptr< NeuralNetwork > CloneWithInputShape( const TensorShape& _inputShape, bool _autotune = true ) const;
+
+		//With _inferenceOnly, gradients and the state recorded for back propagation are not allocated, the network can't be trained
+		bool Load( const char* _filename, bool _inferenceOnly = false );
+		bool IsInferenceOnly() const { return m_IsInferenceOnly; }
+		//Free gradients and what back propagation records once a network is trained, it becomes inference only like Load() with _inferenceOnly
+		void ReleaseTrainingResources();
 		bool Save( const char* _filename, bool _saveTrainingHistory = false ) const;
 
 	private:
+		void AllocateTrainingResources();
+		void OnWeightsChanged();
+		void TuneLayers();
 		void ClearGradients();
 		void ScaleGradients( Scalar _scale );
 		void ApplyGradients( Optimizer& _optimizer );
 		void BackPropagation( const Tensor& _input, const Tensor& _expectedOutput );
+		//Evaluate layers [_firstLayer, _endLayer[, layer outputs needed by back propagation are written to m_LayerOutputs when _storeLayersOutput is set
+		void EvaluateLayers( const Tensor& _in, Tensor* _out, uint32_t _firstLayer, uint32_t _endLayer, bool _storeLayersOutput, bool _storeCheckpointsOnly,
+							 EvaluationWorkspace& _workspace ) const;
+		//Inference only: an Upsample2D followed by a Convolution2D is evaluated by the convolution (see Convolution2D::ForwardUpsampled)
+		bool IsFusedWithNextLayer( uint32_t _layer, uint32_t _endLayer ) const;
+		bool IsOutputNeededForBackPropagation( uint32_t _layer ) const;
+		bool IsLayerOutputStored( uint32_t _layer, bool _checkpointsOnly ) const;
+		void RecomputeSegment( const Tensor& _input, uint32_t _checkpointLayer );
 
 	private:
 		std::vector< std::unique_ptr<Layer> > m_Layers;
+		std::vector< bool > m_IsCheckpoint; //Per layer, empty when gradient checkpointing is disabled
+		mutable std::vector< Tensor > m_LayerOutputs; //Per layer outputs of the training sample being back propagated, persistent so that they are allocated once
 		
 		History m_History;
 
+		AugmentationPipeline* m_AugmentationPipeline = nullptr;
+		std::string m_TuningCacheFilename; //Empty when autotuning is disabled
+
 		bool m_EnableClassificationAccuracyLog = false;
 		bool m_StopTraining = false;
 		bool m_IsTraining = false;
+		bool m_IsInferenceOnly = false;
+		std::atomic< uint64_t > m_WeightsVersion = { 0 }; //Written by the training thread, read by the UI
 	};
 
 	uint32_t GetMostProbableClassIndex( const Tensor& _tensor );
@@ -61,4 +61,56 @@ namespace ToyDNN
 		uint32_t m_SX, m_SY, m_SZ;
 		uint32_t m_Padding;
 	};
+
+	//Pixels [X0, X1[ x [Y0, Y1[ of every channel of a tensor, in the coordinates of TensorShape::Index()
+	struct Region
+	{
+		uint32_t X0 = 0, Y0 = 0, X1 = 0, Y1 = 0;
+
+		Region() {}
+		Region( uint32_t _x0, uint32_t _y0, uint32_t _x1, uint32_t _y1 ) : X0( _x0 ), Y0( _y0 ), X1( _x1 ), Y1( _y1 ) {}
+
+		static Region Whole( const TensorShape& _shape ) { return Region( 0, 0, _shape.m_SX, _shape.m_SY ); }
+
+		inline bool IsEmpty() const { return (X0 >= X1) || (Y0 >= Y1); }
+
+		//Grow to include pixel (_x, _y)
+		inline void Add( uint32_t _x, uint32_t _y )
+		{
+			if( IsEmpty() )
+			{
+				*this = Region( _x, _y, _x + 1, _y + 1 );
+				return;
+			}
+
+			X0 = _x < X0 ? _x : X0;
+			Y0 = _y < Y0 ? _y : Y0;
+			X1 = _x + 1 > X1 ? _x + 1 : X1;
+			Y1 = _y + 1 > Y1 ? _y + 1 : Y1;
+		}
+	};
+
+	//Copy an unpadded tensor into the padded layout described by _paddedShape, padding is filled with zeroes
+	inline void CopyToPaddedTensor( const Tensor& _in, const TensorShape& _paddedShape, Tensor& _out )
+	{
+		const uint32_t sx = _paddedShape.m_SX - _paddedShape.m_Padding;
+		const uint32_t sy = _paddedShape.m_SY - _paddedShape.m_Padding;
+
+		assert( _in.size() == _paddedShape.SizeWithoutPadding() );
+		assert( &_in != &_out );
+
+		_out.assign( _paddedShape.Size(), Scalar( 0 ) );
+
+		for( uint32_t z = 0 ; z < _paddedShape.m_SZ ; ++z )
+		{
+			for( uint32_t y = 0 ; y < sy ; ++y )
+			{
+				const Scalar* src = &_in[sx * (sy * z + y)];
+				Scalar* dst = &_out[_paddedShape.PaddedIndex( 0, y, z )];
+
+				for( uint32_t x = 0 ; x < sx ; ++x )
+					dst[x] = src[x];
+			}
+		}
+	}
 }
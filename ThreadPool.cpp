@@ -0,0 +1,61 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+#undef min
+#undef max
+#include <algorithm>
+
+namespace ToyDNN
+{
+	ThreadPool::ThreadPool( uint32_t _numThreads )
+	{
+		if( _numThreads == 0 )
+			_numThreads = std::max( 1u, std::thread::hardware_concurrency() );
+
+		for( uint32_t i = 0 ; i < _numThreads ; ++i )
+		{
+			m_Threads.push_back( std::thread( &ThreadPool::WorkerThread, this ) );
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard< std::mutex > lock( m_Mutex );
+			m_Stop = true;
+		}
+
+		m_Condition.notify_all();
+
+		//Pending tasks are still executed, so that no future is left without a value
+		for( std::thread& thread : m_Threads )
+			thread.join();
+	}
+
+	void ThreadPool::WorkerThread()
+	{
+		while( true )
+		{
+			std::function< void() > task;
+
+			{
+				std::unique_lock< std::mutex > lock( m_Mutex );
+				m_Condition.wait( lock, [this]() { return m_Stop || !m_Tasks.empty(); } );
+
+				if( m_Tasks.empty() )
+					return; //m_Stop is set and there is nothing left to do
+
+				task = std::move( m_Tasks.front() );
+				m_Tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+
+	ThreadPool& GetSharedThreadPool()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+}
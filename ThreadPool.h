@@ -0,0 +1,58 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <deque>
+#include <vector>
+
+namespace ToyDNN
+{
+	//Fixed size pool of worker threads consuming a FIFO of tasks
+	class ThreadPool
+	{
+	public:
+		explicit ThreadPool( uint32_t _numThreads = 0 ); //0 means one thread per hardware thread
+		~ThreadPool();
+
+		ThreadPool( const ThreadPool& ) = delete;
+		ThreadPool& operator=( const ThreadPool& ) = delete;
+
+		inline uint32_t GetNumThreads() const { return (uint32_t)m_Threads.size(); }
+
+		template< typename Func >
+		auto Enqueue( Func&& _func ) -> std::future< decltype( _func() ) >
+		{
+			typedef decltype( _func() ) ResultType;
+
+			//std::function needs a copyable callable, std::packaged_task is move only
+			auto task = std::make_shared< std::packaged_task< ResultType() > >( std::forward<Func>( _func ) );
+			std::future< ResultType > result = task->get_future();
+
+			{
+				std::lock_guard< std::mutex > lock( m_Mutex );
+				m_Tasks.push_back( [task]() { (*task)(); } );
+			}
+
+			m_Condition.notify_one();
+
+			return result;
+		}
+
+	private:
+		void WorkerThread();
+
+	private:
+		std::vector< std::thread > m_Threads;
+		std::deque< std::function< void() > > m_Tasks;
+		std::mutex m_Mutex;
+		std::condition_variable m_Condition;
+		bool m_Stop = false;
+	};
+
+	//Pool owned by the library for asynchronous inference (see NeuralNetwork::EvaluateAsync()), created on first use
+	ThreadPool& GetSharedThreadPool();
+}
@@ -0,0 +1,169 @@
+#include "pch.h"
+#include "TiledExecutor.h"
+
+#undef min
+#undef max
+#include <algorithm>
+
+namespace ToyDNN
+{
+	//Output pixels an input pixel _x reaches beyond its own footprint scaled to the output, given its affected output range [_affected0, _affected1[
+	static uint32_t GetSpread( uint32_t _x, uint32_t _affected0, uint32_t _affected1, uint32_t _outputScale, uint32_t _inputScale )
+	{
+		const uint32_t scaled0 = _x * _outputScale / _inputScale;
+		const uint32_t scaled1 = ((_x + 1) * _outputScale + _inputScale - 1) / _inputScale;
+
+		return std::max( scaled0 - std::min( _affected0, scaled0 ), std::max( _affected1, scaled1 ) - scaled1 );
+	}
+
+	//Halo in input pixels: outputs closer than that to a tile border read zero padding instead of the neighbor tile.
+	//+1 for rounding, the influence of a layer's zero padding spreads the same way as the one of an input pixel.
+	static uint32_t GetHalo( uint32_t _spread, uint32_t _outputScale, uint32_t _inputScale, uint32_t _alignment )
+	{
+		uint32_t halo = (_spread * _inputScale + _outputScale - 1) / _outputScale + 1;
+		return (halo + _alignment - 1) / _alignment * _alignment;
+	}
+
+	bool TiledExecutor::Setup( const NeuralNetwork& _network, const TensorShape& _imageShape, uint32_t _tileSize )
+	{
+		m_TileNetwork.reset();
+
+		assert( _imageShape.m_Padding == 0 );
+
+		//Tiles must start on the grid of every strided layer, otherwise they would sample other pixels than the whole image does
+		uint32_t alignmentX = 1, alignmentY = 1;
+
+		for( uint32_t i = 0 ; i < _network.DbgGetLayerCount() ; ++i )
+		{
+			alignmentX *= _network.DbgGetLayer( i )->GetDownsamplingFactorX();
+			alignmentY *= _network.DbgGetLayer( i )->GetDownsamplingFactorY();
+		}
+
+		if( (_imageShape.m_SX % alignmentX != 0) || (_imageShape.m_SY % alignmentY != 0) )
+		{
+			Log( "TiledExecutor: image size must be a multiple of %dx%d\n", alignmentX, alignmentY );
+			return false;
+		}
+
+		m_TileSizeX = (std::max( _tileSize, 1u ) + alignmentX - 1) / alignmentX * alignmentX;
+		m_TileSizeY = (std::max( _tileSize, 1u ) + alignmentY - 1) / alignmentY * alignmentY;
+
+		//Measure how far input pixels spread through the network, on a large enough test tile. It is never evaluated, no need to tune it
+		const uint32_t testSX = 4 * alignmentX * ((16 + alignmentX - 1) / alignmentX);
+		const uint32_t testSY = 4 * alignmentY * ((16 + alignmentY - 1) / alignmentY);
+		std::unique_ptr< NeuralNetwork > testNetwork = _network.CloneWithInputShape( TensorShape( testSX, testSY, _imageShape.m_SZ ), false );
+
+		if( !testNetwork )
+			return false;
+
+		const TensorShape& testOutputShape = testNetwork->DbgGetLayer( testNetwork->DbgGetLayerCount() - 1 )->GetOutputShape();
+		m_OutputScaleX = testOutputShape.m_SX;
+		m_OutputScaleY = testOutputShape.m_SY;
+		m_InputScaleX = testSX;
+		m_InputScaleY = testSY;
+
+		//In output pixels, on either side of the footprint of an input pixel scaled to the output.
+		//Layers map axes independently, one input pixel per phase of both alignments is enough.
+		uint32_t spreadX = 0, spreadY = 0;
+
+		for( uint32_t i = 0 ; i < std::max( alignmentX, alignmentY ) ; ++i )
+		{
+			const uint32_t x = testSX / 2 + i % alignmentX;
+			const uint32_t y = testSY / 2 + i % alignmentY;
+			Region region( x, y, x + 1, y + 1 );
+
+			for( uint32_t layer = 0 ; layer < testNetwork->DbgGetLayerCount() ; ++layer )
+				region = testNetwork->DbgGetLayer( layer )->GetAffectedOutputRegion( region );
+
+			spreadX = std::max( spreadX, GetSpread( x, region.X0, region.X1, m_OutputScaleX, m_InputScaleX ) );
+			spreadY = std::max( spreadY, GetSpread( y, region.Y0, region.Y1, m_OutputScaleY, m_InputScaleY ) );
+		}
+
+		m_HaloX = GetHalo( spreadX, m_OutputScaleX, m_InputScaleX, alignmentX );
+		m_HaloY = GetHalo( spreadY, m_OutputScaleY, m_InputScaleY, alignmentY );
+
+		m_ImageShape = _imageShape;
+		m_TileWindowSX = std::min( m_TileSizeX + 2 * m_HaloX, _imageShape.m_SX );
+		m_TileWindowSY = std::min( m_TileSizeY + 2 * m_HaloY, _imageShape.m_SY );
+
+		if( ((alignmentX * m_OutputScaleX) % m_InputScaleX != 0) || ((_imageShape.m_SX * m_OutputScaleX) % m_InputScaleX != 0) ||
+			((alignmentY * m_OutputScaleY) % m_InputScaleY != 0) || ((_imageShape.m_SY * m_OutputScaleY) % m_InputScaleY != 0) )
+		{
+			Log( "TiledExecutor: the network output isn't a whole multiple of its input\n" );
+			return false;
+		}
+
+		m_TileNetwork = _network.CloneWithInputShape( TensorShape( m_TileWindowSX, m_TileWindowSY, _imageShape.m_SZ ) );
+
+		if( !m_TileNetwork )
+			return false;
+
+		const TensorShape& tileOutputShape = m_TileNetwork->DbgGetLayer( m_TileNetwork->DbgGetLayerCount() - 1 )->GetOutputShape();
+		m_OutputShape = TensorShape( _imageShape.m_SX * m_OutputScaleX / m_InputScaleX, _imageShape.m_SY * m_OutputScaleY / m_InputScaleY, tileOutputShape.m_SZ );
+
+		assert( tileOutputShape.m_SX == m_TileWindowSX * m_OutputScaleX / m_InputScaleX );
+		assert( tileOutputShape.m_SY == m_TileWindowSY * m_OutputScaleY / m_InputScaleY );
+
+		Log( "TiledExecutor: %dx%d tiles, %dx%d with halos\n", m_TileSizeX, m_TileSizeY, m_TileWindowSX, m_TileWindowSY );
+
+		return true;
+	}
+
+	void TiledExecutor::Evaluate( const Tensor& _image, Tensor& _out ) const
+	{
+		assert( m_TileNetwork );
+		assert( _image.size() == m_ImageShape.Size() );
+
+		_out.resize( m_OutputShape.Size() );
+
+		const int numTilesX = (int)((m_ImageShape.m_SX + m_TileSizeX - 1) / m_TileSizeX);
+		const int numTilesY = (int)((m_ImageShape.m_SY + m_TileSizeY - 1) / m_TileSizeY);
+		const TensorShape windowShape( m_TileWindowSX, m_TileWindowSY, m_ImageShape.m_SZ );
+		const TensorShape& windowOutputShape = m_TileNetwork->DbgGetLayer( m_TileNetwork->DbgGetLayerCount() - 1 )->GetOutputShape();
+
+		#pragma omp parallel
+		{
+			//Peak memory: one tile and its activations per thread
+			Tensor window( windowShape.Size() ), windowOutput;
+			EvaluationWorkspace workspace;
+
+			#pragma omp for schedule( dynamic )
+			for( int tile = 0 ; tile < numTilesX * numTilesY ; ++tile )
+			{
+				//Tile [x0, x1[ x [y0, y1[ is read from the window starting at (wx, wy), every window has the same size.
+				//Windows are shifted inward at the image borders, where zero padding is the same as for the whole image.
+				const uint32_t x0 = (tile % numTilesX) * m_TileSizeX;
+				const uint32_t y0 = (tile / numTilesX) * m_TileSizeY;
+				const uint32_t x1 = std::min( x0 + m_TileSizeX, m_ImageShape.m_SX );
+				const uint32_t y1 = std::min( y0 + m_TileSizeY, m_ImageShape.m_SY );
+				const uint32_t wx = std::min( x0 - std::min( x0, m_HaloX ), m_ImageShape.m_SX - m_TileWindowSX );
+				const uint32_t wy = std::min( y0 - std::min( y0, m_HaloY ), m_ImageShape.m_SY - m_TileWindowSY );
+
+				for( uint32_t z = 0 ; z < windowShape.m_SZ ; ++z )
+				{
+					for( uint32_t y = 0 ; y < windowShape.m_SY ; ++y )
+					{
+						const Scalar* src = &_image[m_ImageShape.Index( wx, wy + y, z )];
+						std::copy( src, src + windowShape.m_SX, &window[windowShape.Index( 0, y, z )] );
+					}
+				}
+
+				m_TileNetwork->Evaluate( window, windowOutput, workspace );
+
+				//Keep the outputs of the tile itself
+				const uint32_t outX0 = x0 * m_OutputScaleX / m_InputScaleX, outX1 = x1 * m_OutputScaleX / m_InputScaleX;
+				const uint32_t outY0 = y0 * m_OutputScaleY / m_InputScaleY, outY1 = y1 * m_OutputScaleY / m_InputScaleY;
+				const uint32_t windowOutX = wx * m_OutputScaleX / m_InputScaleX, windowOutY = wy * m_OutputScaleY / m_InputScaleY;
+
+				for( uint32_t z = 0 ; z < m_OutputShape.m_SZ ; ++z )
+				{
+					for( uint32_t y = outY0 ; y < outY1 ; ++y )
+					{
+						const Scalar* src = &windowOutput[windowOutputShape.Index( outX0 - windowOutX, y - windowOutY, z )];
+						std::copy( src, src + (outX1 - outX0), &_out[m_OutputShape.Index( outX0, y, z )] );
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+#include <memory>
+
+namespace ToyDNN
+{
+	//Evaluates a fully convolutional network on images of any size with memory bounded by the tile size.
+	//The image is split in tiles extended by a halo derived from the receptive field of the network, each tile is evaluated
+	//(in parallel) by a copy of the network reshaped to the tile size, and only the part of its output which doesn't depend on
+	//the halo borders is kept: the stitched result is exactly the one of the whole image evaluated at once.
+	class TiledExecutor
+	{
+	public:
+		//_tileSize is the size of the output written by each tile, in input pixels, it is rounded up to the alignment required by strided layers.
+		//Image sizes must be multiples of that alignment.
+		bool Setup( const NeuralNetwork& _network, const TensorShape& _imageShape, uint32_t _tileSize );
+
+		void Evaluate( const Tensor& _image, Tensor& _out ) const;
+
+		const TensorShape& GetOutputShape() const { return m_OutputShape; }
+
+	private:
+		std::unique_ptr< NeuralNetwork > m_TileNetwork; //Reshaped to the tile size, including halos
+		TensorShape m_ImageShape, m_OutputShape;
+		uint32_t m_TileSizeX = 0, m_TileSizeY = 0; //Rounded up to the alignment of each axis
+		uint32_t m_HaloX = 0, m_HaloY = 0; //In input pixels, on each side of a tile
+		uint32_t m_TileWindowSX = 0, m_TileWindowSY = 0; //Tile size with halos, in input pixels
+		uint32_t m_OutputScaleX = 1, m_InputScaleX = 1; //Output pixels per input pixel along x is m_OutputScaleX / m_InputScaleX
+		uint32_t m_OutputScaleY = 1, m_InputScaleY = 1;
+	};
+}
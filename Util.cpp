@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <intrin.h>
 
 #include <windows.h>
 #undef min
@@ -25,6 +27,102 @@ namespace ToyDNN
 		OutputDebugStringA( buffer );
 	}
 
+	std::string GetCpuName()
+	{
+		int registers[4];
+		__cpuid( registers, 0x80000000 );
+
+		if( (unsigned)registers[0] < 0x80000004 )
+			return "Unknown CPU";
+
+		char brand[49] = {};
+
+		for( int i = 0 ; i < 3 ; ++i )
+		{
+			__cpuid( registers, 0x80000002 + i );
+			memcpy( &brand[i * 16], registers, sizeof( registers ) );
+		}
+
+		//Trim the padding some processors put around the name
+		std::string name( brand );
+		name.erase( 0, name.find_first_not_of( ' ' ) );
+		name.erase( name.find_last_not_of( ' ' ) + 1 );
+
+		return name;
+	}
+
+	static const int s_FileFormatVersionSlot = std::ios_base::xalloc(); //Stream storage, 0 until set
+
+	FileFormatVersion GetFileFormatVersion( std::ios_base& _stream )
+	{
+		long version = _stream.iword( s_FileFormatVersionSlot );
+		return version != 0 ? (FileFormatVersion)version : FileFormatVersion::Current;
+	}
+
+	void SetFileFormatVersion( std::ios_base& _stream, FileFormatVersion _version )
+	{
+		_stream.iword( s_FileFormatVersionSlot ) = (long)_version;
+	}
+
+	bool MemoryMappedFile::Open( const char* _filename )
+	{
+		Close();
+
+		HANDLE file = CreateFileA( _filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+
+		if( file == INVALID_HANDLE_VALUE )
+			return false;
+
+		LARGE_INTEGER fileSize;
+
+		if( !GetFileSizeEx( file, &fileSize ) || (fileSize.QuadPart == 0) )
+		{
+			CloseHandle( file );
+			return false;
+		}
+
+		HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+
+		if( mapping == NULL )
+		{
+			CloseHandle( file );
+			return false;
+		}
+
+		const void* data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+
+		if( data == NULL )
+		{
+			CloseHandle( mapping );
+			CloseHandle( file );
+			return false;
+		}
+
+		m_File = file;
+		m_Mapping = mapping;
+		m_Data = (const uint8_t*)data;
+		m_Size = (size_t)fileSize.QuadPart;
+
+		return true;
+	}
+
+	void MemoryMappedFile::Close()
+	{
+		if( m_Data )
+			UnmapViewOfFile( m_Data );
+
+		if( m_Mapping )
+			CloseHandle( m_Mapping );
+
+		if( m_File )
+			CloseHandle( m_File );
+
+		m_File = nullptr;
+		m_Mapping = nullptr;
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+
 	void Color::Saturate()
 	{
 		R = std::min( R, 1.0f );
@@ -4,6 +4,7 @@
 #include <istream>
 #include <ostream>
 #include <random>
+#include <string>
 
 #include "Tensor.h"
 
@@ -35,6 +36,49 @@ namespace ToyDNN
 
 	extern Random g_Random;
 
+	//Counter based generator (SplitMix64 mixing of a key and a counter): the Nth number of a stream only depends
+	//on (seed, stream, N), so it gives the same results whatever the thread consuming the stream or the scheduling order
+	class CounterBasedRandom
+	{
+	public:
+		CounterBasedRandom( uint64_t _seed, uint64_t _stream ) :
+			m_Key( Mix( _seed ^ Mix( _stream + 0x9E3779B97F4A7C15ull ) ) ),
+			m_Counter( 0 )
+		{
+		}
+
+		inline uint64_t Next()
+		{
+			return Mix( m_Key + 0x9E3779B97F4A7C15ull * ++m_Counter );
+		}
+
+		//in [_min, _max[
+		inline Scalar UniformDistribution( Scalar _min, Scalar _max )
+		{
+			//53 random bits mapped to [0,1[
+			Scalar unit = Scalar( Next() >> 11 ) * Scalar( 1.0 / 9007199254740992.0 );
+			return _min + unit * (_max - _min);
+		}
+
+		//in [0, _n[
+		inline uint32_t UniformInt( uint32_t _n )
+		{
+			return (uint32_t)(((Next() >> 32) * _n) >> 32);
+		}
+
+	private:
+		static inline uint64_t Mix( uint64_t _z )
+		{
+			_z = (_z ^ (_z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			_z = (_z ^ (_z >> 27)) * 0x94D049BB133111EBull;
+			return _z ^ (_z >> 31);
+		}
+
+	private:
+		uint64_t m_Key;
+		uint64_t m_Counter;
+	};
+
 	void Log( const char* _format, ... );
 
 	inline Scalar Lerp( Scalar t, Scalar a, Scalar b )
@@ -42,8 +86,56 @@ namespace ToyDNN
 		return a + t * (b - a);
 	}
 
+	//Threads only pay off for large enough loops, counted in multiply-adds
+	inline bool IsWorthParallelizing( size_t _numMultiplyAdds )
+	{
+		return _numMultiplyAdds >= (1 << 18);
+	}
+
 	bool WriteBMP( const char* _filename, bool _grayscale, const Tensor& _pixels, int _width, int _height );
 
+	//Brand string of the processor, like "Intel(R) Core(TM) i7-8700 CPU @ 3.20GHz"
+	std::string GetCpuName();
+
+	//Read only view of a whole file mapped in memory, pages are loaded lazily by the OS
+	class MemoryMappedFile
+	{
+	public:
+		MemoryMappedFile() {}
+		~MemoryMappedFile() { Close(); }
+
+		MemoryMappedFile( const MemoryMappedFile& ) = delete;
+		MemoryMappedFile& operator=( const MemoryMappedFile& ) = delete;
+
+		bool Open( const char* _filename );
+		void Close();
+
+		inline bool IsOpen() const { return m_Data != nullptr; }
+		inline const uint8_t* GetData() const { return m_Data; }
+		inline size_t GetSize() const { return m_Size; }
+
+	private:
+		void* m_File = nullptr; //HANDLE
+		void* m_Mapping = nullptr; //HANDLE
+		const uint8_t* m_Data = nullptr;
+		size_t m_Size = 0;
+	};
+
+	//Saved networks start with a magic number and the version of the format, files written before that have neither (Legacy)
+	enum class FileFormatVersion : uint32_t
+	{
+		Legacy = 1,
+		Dilation = 2, //Convolution2D dilation
+		Padding = 3, //Convolution2D padding mode, deduced from the shapes before
+		Current = Padding
+	};
+
+	const uint32_t c_FileFormatMagic = 0x4E4E4454; //"TDNN"
+
+	//Version of the file read from _stream, set by NeuralNetwork::Load(). Streams it wasn't set on (copies in memory) hold the current version
+	FileFormatVersion GetFileFormatVersion( std::ios_base& _stream );
+	void SetFileFormatVersion( std::ios_base& _stream, FileFormatVersion _version );
+
 	template< typename T >
 	void Write( std::ostream& _stream, const T& _val )
 	{